@@ -1,4 +1,6 @@
 #include <iostream>
+#include <chrono>
+#include <climits>
 #include <future>
 #include <string>
 
@@ -10,10 +12,17 @@
 #include "camera.h"
 #include "material.h"
 #include "quad.h"
+#include "triangle_mesh.h"
+#include "mesh_loader.h"
+#include "scheduler.h"
+#include "wide_bvh.h"
+#include "scene_cache.h"
+#include "lights.h"
+#include "framebuffer.h"
+#include "checkpoint.h"
+#include "wavefront.h"
 
 //TODO: 
-//		- 3d-models, I don't really know what else to add to this statement
-// 
 //		- light sources:
 //			- point light sources which should be pretty straight forward
 //			- directional light sources (here comes the sun) with radius
@@ -25,10 +34,40 @@
 // 
 //		- as stated in the book: volumetrics (fog), which is apparently covered in "raytracing the next week"
 
-color rayColor(const ray& r, const color& background, const hittable& world, int depth);
-
-void startRender(const int imageWidth, float aspectRatio, const color& background, const int samples, const int bounces, hittable_list& world, const int processorCount, camera& cam);
-std::vector<int> render(int imageWidth, int imageHeight_steps, int imageHeight, int j, const color& background, int samples, int bounces, const hittable_list& world, const camera& cam);
+//how much work goes into every pixel
+struct render_settings {
+	int samples;			//samples per pixel, with adaptive sampling the least a pixel gets
+	int bounces;
+	bool adaptive;			//noisy pixels keep going up to max_samples, the rest stop once they're below noise_threshold
+	int max_samples;
+	float noise_threshold;	//standard error in output brightness, 1 is white
+	int pass_samples;		//samples per pixel and pass, the image can be looked at after every pass
+	bool previews;			//write image.png after every pass instead of only at the end
+	int checkpoint_seconds;	//the render gets saved to render.checkpoint after the first pass that ends this long after the last save
+	bool resume;			//carry on from render.checkpoint if the same build with the same settings wrote it
+	float time_budget;		//seconds for the whole render, 0 for none. samples keep going to the noisiest pixels until it runs out
+	bool wavefront;			//trace each tile's paths together stage by stage instead of one after the other, see wavefront.h
+	bool packets;			//without depth of field the camera rays of 4x4 pixels go through the bvh together
+};
+
+template <int MaxBounces, bool LightSampling>
+color rayColor(const ray& r, const color& background, const hittable& world, const light_list& lights, int bounces, const ray_packet* packet = nullptr, int index = 0);
+hittable_list buildScene();
+
+//one tile of one pass, see pickKernel
+using render_kernel = void (*)(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image);
+
+void startRender(const int imageWidth, float aspectRatio, const color& background, const render_settings& settings, const hittable& world, const int processorCount, camera& cam);
+bool markActive(const framebuffer& image, float threshold, std::vector<char>& active);
+void writeImage(framebuffer& image, int workerCount);
+render_kernel pickKernel(const render_settings& settings, const light_list& lights, const camera& cam);
+void renderWorker(int worker, tile_scheduler& scheduler, render_kernel kernel, std::chrono::steady_clock::time_point deadline, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image);
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void render(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image);
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void renderWavefront(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image);
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void renderPackets(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image);
 
 int WinMain() {
 	
@@ -40,8 +79,26 @@ int WinMain() {
 	// Image quality
 	const int samples_per_pixel = 50;
 	const int bounces = 20;
+	//adaptive sampling: every pixel gets samples_per_pixel, the noisy ones keep going until they're below the threshold
+	const bool adaptiveSampling = false;
+	const int max_samples_per_pixel = 400;
+	const float noise_threshold = 0.004f;
+	//the image is rendered in passes of this many samples, with previews image.png gets updated after each one
+	const int samples_per_pass = 8;
+	const bool writePreviews = true;
+	//long renders get saved every few minutes, running the same build again picks up where the last save left off
+	//and ends up with the same image as if it had never been stopped
+	const int checkpoint_seconds = 300;
+	const bool resumeRender = true;
+	//with a time budget (in seconds) the sample counts above don't matter, the render takes as long as it's given
+	const float time_budget = 0;
+	//same image either way, the wavefront one sorts the hits by material before shading them
+	const bool wavefront = false;
+	const bool packets = true;
 	const bool doDepthOfField = true;
 	const color background(0.01, 0.01, 0.01);
+	render_seed() = 0;
+	render_sampler() = sampler_type::sobol;
 
 	// Get CPU specs
 	const auto processor_count = std::thread::hardware_concurrency();
@@ -60,6 +117,35 @@ int WinMain() {
 	camera cam(lookfrom, lookat, vup, fov, aspect_ratio);
 
 	// world
+	//the compiled scene (bvh, meshes, materials and texture pixels) gets saved to scene.rtcache and mapped back in on the next run,
+	//it's rebuilt whenever the program is recompiled or any texture or model file it was built from changes
+	scene_cache cache("scene.rtcache", __DATE__ " " __TIME__);
+	auto world = cache.load();
+	if (!world) {
+		//rays only get tested against the objects whose boxes they pass through,
+		//flattened into one array with 4 or 8 children per node depending on what the cpu can test in one go
+		world = build_bvh(buildScene());
+		cache.save(*world);
+	}
+	
+	// Depth of field: get camera ray at the center of the image, if it hits anything compute the distance and set DoF
+	//world.hit returns false for some reason, something is off with the math below
+	hit_record rec;
+	auto s = image_width / 2;
+	auto t = image_height / 2;
+	ray r = cam.get_ray(s / (image_width - 1), t / (image_height - 1));
+	if (world->hit(r, 0.001, infinity, rec) && doDepthOfField) {
+		float defocusDist = vec3(lookfrom - rec.p).length();
+		cam.setDoF(defocusDist, 3);
+	}
+
+	render_settings settings = { samples_per_pixel, bounces, adaptiveSampling, max_samples_per_pixel, noise_threshold, samples_per_pass, writePreviews, checkpoint_seconds, resumeRender, time_budget, wavefront, packets };
+	startRender(image_width, aspect_ratio, background, settings, *world, processor_count, cam);
+
+	return 0;
+}
+
+hittable_list buildScene() {
 	hittable_list world;
 
 	// materials
@@ -94,12 +180,13 @@ int WinMain() {
 	auto sand = make_shared<lambertian>(sand_texture);
 	auto redstone_lamp = make_shared<diffuse_light>(make_shared<image_texture>("textures/redstone_lamp.png"), redstone_emission);
 
-		//CAUTION: Adding hittables currently increases render time by a lot! (remove when bounding boxes are implemented)
 	//		boxes:				point3 start, point3 end, material
 	//							point3 origin, vec3 a, vec3 b, vec3 height, material
 	//		triangles:			point3 a, point3 b, point3 c, material
 	//		quads:				point3 pos, vec3 v, vec3 u, material
 	//		spheres:			point3 pos, radius, material
+	//		meshes:				positions, indices (3 per triangle), material
+	//		model files:		load_mesh(".obj or binary .ply file", material)
 
 	world.add(make_shared<box>(point3(70, 165, 230), point3(230, 0, 65), redstone_lamp));
 	world.add(make_shared<box>(point3(265, 0, 295), vec3(165, 0, -100), vec3(50, 40, 165), vec3(10, 330, 0), sand));
@@ -109,6 +196,8 @@ int WinMain() {
 	//world.add(make_shared<triangle>(point3(-3, -1, 0), point3(2, -2, -4), point3(2.5, 3, -3), some_surface_light));
 	//world.add(make_shared<triangle>(point3(1, 0, -4), point3(2, 0, -6), point3(3, 3, -7), material_center));
 
+	//world.add(load_mesh("models/bunny.ply", white));
+
 	world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 555, 0), vec3(555,0,0), cyan_light));
 	world.add(make_shared<quad>(point3(0, 0, 555), vec3(0, 555, 0), vec3(0, 0, -555), make_shared<metal>(crappy_bricks, redstone_emission)));
 	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), red));
@@ -116,98 +205,379 @@ int WinMain() {
 	world.add(make_shared<quad>(point3(555, 0, 555), vec3(0, 555, 0), vec3(0, 0, -555), blue));
 
 	//world.add(make_shared<sphere>(point3(275, 400, 250), 75, material_right0));
-	
-	// Depth of field: get camera ray at the center of the image, if it hits anything compute the distance and set DoF
-	//world.hit returns false for some reason, something is off with the math below
-	hit_record rec;
-	auto s = image_width / 2;
-	auto t = image_height / 2;
-	ray r = cam.get_ray(s / (image_width - 1), t / (image_height - 1));
-	if (world.hit(r, 0.001, infinity, rec) && doDepthOfField) {
-		float defocusDist = vec3(lookfrom - rec.p).length();
-		cam.setDoF(defocusDist, 3);
-	}
 
-	startRender(image_width, aspect_ratio, background, samples_per_pixel, bounces, world, processor_count, cam);
+	return world;
+}
 
-	return 0;
+//MaxBounces 0 takes the bounce limit from bounces, LightSampling false never looks at the lights directly.
+//if r is ray index of a packet that has already been traced, the first hit is taken from there
+template <int MaxBounces, bool LightSampling>
+color rayColor(const ray& r, const color& background, const hittable& world, const light_list& lights, int bounces, const ray_packet* packet, int index) {
+	if (MaxBounces > 0)
+		bounces = MaxBounces;
+
+	//follows the path one bounce at a time instead of recursing,
+	//throughput is how much of whatever gets found further down still makes it back to the camera
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+	ray current = r;
+
+	//paths get a few bounces before russian roulette may end them
+	const int roulette_start = 3;
+
+	//density of the direction the last bounce picked, 0 if the lights weren't sampled there.
+	//lights hit by such a bounce get weighted against light sampling, see direct_light
+	float bounce_pdf = 0;
+
+	for (int depth = 0; depth < bounces; depth++) {
+		hit_record rec;
+		auto found = depth == 0 && packet ? packet->hit(index, rec) : world.hit(current, 0.001, infinity, rec);
+		if (!found)
+			return radiance + throughput * background;
+
+		ray scattered;
+		color attenuation;
+		color emitted;
+
+		const auto& mat = scene_materials()[rec.mat_id];
+		if (mat.emitted(current, rec, attenuation, scattered, emitted)) {
+			//hit a light source
+			float weight = 1;
+			if (LightSampling && bounce_pdf > 0) {
+				auto distance_squared = rec.t * rec.t * current.direction().length_squared();
+				auto light_cosine = fabs(dot(unit_vector(current.direction()), rec.normal));
+				weight = power_heuristic(bounce_pdf, lights.pdf(distance_squared, light_cosine));
+			}
+			return radiance + weight * throughput * emitted;
+		}
+
+		//the last bounce doesn't look at the lights, its ray would never be traced
+		bool sample_lights = LightSampling && !mat.is_specular(rec) && depth + 1 < bounces;
+		if (sample_lights)
+			radiance += throughput * direct_light(current, rec, mat, lights, world);
+
+		//hit a non light source object, scattering into the surface absorbs the path
+		if (!mat.scatter(current, rec, attenuation, scattered))
+			return radiance;
+		throughput = throughput * attenuation;
+		bounce_pdf = sample_lights ? mat.pdf(current, rec, unit_vector(scattered.direction())) : 0;
+
+		//dark paths are ended at random, the ones that survive count for more by the same factor,
+		//so on average the result doesn't change but no time is wasted on paths that carry next to nothing
+		if (depth >= roulette_start) {
+			auto survival = std::min(std::max(throughput.x(), std::max(throughput.y(), throughput.z())), 0.95f);
+			if (random_float() >= survival)
+				return radiance;
+			throughput /= survival;
+		}
+
+		current = scattered;
+	}
+
+	//bounce limit has been exceeded
+	return radiance;
 }
 
-color rayColor(const ray& r, const color& background, const hittable& world, int bounces) {
-	hit_record rec;
+void startRender(const int imageWidth, float aspectRatio, const color& background, const render_settings& settings, const hittable& world, const int processorCount, camera& cam) {
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	auto budgeted = settings.time_budget > 0;
+	auto end = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(settings.time_budget));
+	//how long writing the image takes, that much of the budget is kept free for the last one
+	clock::duration writeTime(0);
 
-	if (bounces <= 0)
-		//bounce limit has been exceeded
-		return color(0, 0, 0);
+	auto imageHeight = static_cast<int>(imageWidth / aspectRatio);
+	auto workerCount = std::max(processorCount, 1);
+
+	//everything gets summed up in linear floats, the png is only made from it when it gets written
+	framebuffer image(imageWidth, imageHeight);
+
+	//diffuse surfaces sample the lights directly instead of waiting for a bounce to find them
+	light_list lights;
+	if (auto prims = bvh_primitives(world))
+		lights = light_list(*prims);
+
+	//the render loop compiled for exactly these settings, whatever they don't use isn't in there
+	auto kernel = pickKernel(settings, lights, cam);
+
+	//pixels that still get samples in the next pass, empty means all of them
+	std::vector<char> active;
+
+	//__DATE__ and __TIME__ stand in for the scene and the camera, they're only ever changed by recompiling
+	const char* build = __DATE__ " " __TIME__;
+	auto key = cache_detail::hash_bytes(build, strlen(build));
+	auto fold = [&key](auto value) { key = cache_detail::hash_bytes(&value, sizeof(value), key); };
+	fold(imageWidth);
+	fold(settings.samples);
+	fold(settings.bounces);
+	fold(settings.adaptive);
+	fold(settings.max_samples);
+	fold(settings.pass_samples);
+	fold(settings.noise_threshold);
+	fold(settings.packets);
+	fold(render_seed());
+	fold(render_sampler());
+	fold(sizeof(color));
+	fold(sizeof(pixel_variance));
+	render_checkpoint checkpoint("render.checkpoint", key);
+
+	//a render on a time budget comes out different depending on how fast it went, there's nothing to resume
+	auto checkpointing = !budgeted;
+
+	int done = 0;
+	if (checkpointing && settings.resume && checkpoint.load(image, done))
+		std::cerr << "Resuming from " << done << " samples per pixel.\n";
+	auto lastSave = clock::now();
+
+	auto passSamples = std::max(settings.pass_samples, 1);
+	auto totalSamples = budgeted ? INT_MAX : settings.adaptive ? std::max(settings.samples, settings.max_samples) : settings.samples;
+	//on a budget every pixel gets one pass, after that the noisy ones come first
+	auto minimum = budgeted ? std::min(settings.samples, passSamples) : settings.samples;
+	auto threshold = settings.noise_threshold;
+	for (int samples = 0; done < totalSamples; done += samples) {
+		auto deadline = budgeted ? end - writeTime : clock::time_point::max();
+		if (clock::now() >= deadline)
+			break;
+
+		//adaptive sampling: once every pixel has its minimum, only the ones that aren't converged keep going.
+		//a pixel only stops once its neighbours are converged too, a single lucky pixel that hasn't
+		//run into any of the rare bright paths yet would otherwise stop too early and end up too dark
+		if ((settings.adaptive || budgeted) && done >= minimum) {
+			auto any = markActive(image, threshold, active);
+			//on a budget there's no stopping early: once everything is below the threshold, it gets lower
+			while (!any && budgeted && threshold > 1e-6f) {
+				threshold *= 0.5f;
+				any = markActive(image, threshold, active);
+			}
+			if (!any && !budgeted)
+				break;
+			if (!any)
+				active.clear();
+		}
 
-	if (!world.hit(r, 0.001, infinity, rec))
-		return background;
+		//small tiles instead of one band per thread, whoever runs out of work steals from the others
+		tile_scheduler scheduler(imageWidth, imageHeight, workerCount);
+		//the last pass before adaptive sampling kicks in stops right at the minimum
+		samples = std::min(passSamples, totalSamples - done);
+		if (done < minimum)
+			samples = std::min(samples, minimum - done);
+
+		//to pass something by reference here, std::ref or std::cref (for constant stuff, hence the c) needs to be used
+		std::vector<std::future<void>> ftr;
+		for (int worker = 0; worker < workerCount; worker++)
+			//ridiculous amount of parameters but oh well
+			ftr.push_back(std::async(std::launch::async, renderWorker, worker, std::ref(scheduler), kernel, deadline, samples, std::cref(active), std::cref(background), std::cref(settings), std::cref(world), std::cref(lights), std::cref(cam), std::ref(image)));
+
+		for (auto& oc : ftr)
+			oc.get();
+
+		//on a budget the first pass always gets written, that's when it's known how long writing takes
+		if ((settings.previews && done + samples < totalSamples) || (budgeted && done == 0)) {
+			auto before = clock::now();
+			writeImage(image, workerCount);
+			writeTime = std::max(writeTime, clock::now() - before);
+		}
 
-	ray scattered;
-	color attenuation;
-	color emitted;
+		auto now = clock::now();
+		if (checkpointing && now - lastSave >= std::chrono::seconds(settings.checkpoint_seconds)) {
+			checkpoint.save(image, done + samples);
+			lastSave = now;
+		}
+	}
 
-	if(rec.mat_ptr->emitted(r, rec, attenuation, scattered, emitted))
-		//hit a light source
-		return emitted;
+	if (checkpointing)
+		checkpoint.save(image, done);
 
-	rec.mat_ptr->scatter(r, rec, attenuation, scattered);
+	writeImage(image, workerCount);
+}
 
-	//hit a non light source object
-	return emitted + attenuation * rayColor(scattered, background, world, bounces - 1);
+//marks the pixels that aren't converged and their neighbours, returns false if there are none left
+bool markActive(const framebuffer& image, float threshold, std::vector<char>& active) {
+	std::vector<char> converged(image.variances.size());
+	for (size_t i = 0; i < converged.size(); i++)
+		converged[i] = image.variances[i].converged(threshold);
+
+	active.assign(converged.size(), 0);
+	bool any = false;
+	for (int y = 0; y < image.height; y++) {
+		for (int x = 0; x < image.width; x++) {
+			if (converged[y * image.width + x])
+				continue;
+			for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, image.height - 1); dy++)
+				for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, image.width - 1); dx++)
+					active[dy * image.width + dx] = 1;
+			any = true;
+		}
+	}
+	return any;
 }
 
-void startRender(const int imageWidth, float aspectRatio, const color& background, const int samples, const int bounces, hittable_list& world, const int processorCount, camera& cam) {
-	std::vector<std::future<std::vector<int>>> ftr;
-	std::vector<std::vector<int>> imageData;
+void writeImage(framebuffer& image, int workerCount) {
+	auto pixels = image.resolve(workerCount);
 
-	auto imageHeight = static_cast<int>(imageWidth / aspectRatio);
-	auto heightPixelSteps = static_cast<int>(imageHeight / processorCount);
+	//create .png file									 3 Channels: R, G and B, a fourth one would add the Alpha channel which is useless here
+	stbi_write_png("image.png", image.width, image.height, 3, pixels, image.width * 3);
+}
 
-	//i should probably change this or the vectors to be more consistent with each other
-	//actually i should probably bother with it when i get to memory management
-	unsigned char* image = new unsigned char[imageWidth * imageHeight * 3];
+//picks a render<...> to match the settings, the camera and the lights. every combination is its own copy of the loop
+//with the features that are off compiled out: no lens sampling without depth of field, no light sampling
+//if the lights can't be sampled and no variance bookkeeping unless the passes need it to pick pixels
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+render_kernel pickIntegrator(const render_settings& settings) {
+	if (settings.wavefront)
+		return renderWavefront<DepthOfField, MaxBounces, LightSampling, TrackVariance>;
+	//with a lens the camera rays start all over it, packets only work when they all start at the same point
+	if (settings.packets && !DepthOfField)
+		return renderPackets<DepthOfField, MaxBounces, LightSampling, TrackVariance>;
+	return render<DepthOfField, MaxBounces, LightSampling, TrackVariance>;
+}
 
-	//to pass something by reference here, std::ref or std::cref (for constant stuff, hence the c) needs to be used
-	for (int pos = processorCount-1; pos >= 0; pos--)
-		//ridiculous amount of parameters but oh well
-		ftr.push_back(std::async(render, imageWidth, heightPixelSteps, imageHeight, pos + 1, std::cref(background), samples, bounces, std::cref(world), std::cref(cam)));
+template <bool DepthOfField, bool LightSampling, bool TrackVariance>
+render_kernel pickBounces(const render_settings& settings) {
+	//a constant bounce limit for the counts that get used a lot, add a case for any other one
+	switch (settings.bounces) {
+	case 8:		return pickIntegrator<DepthOfField, 8, LightSampling, TrackVariance>(settings);
+	case 20:	return pickIntegrator<DepthOfField, 20, LightSampling, TrackVariance>(settings);
+	default:	return pickIntegrator<DepthOfField, 0, LightSampling, TrackVariance>(settings);
+	}
+}
 
-	//future of vector of int to vector of int
-	for (auto& oc : ftr)
-		imageData.push_back(oc.get());
+template <bool DepthOfField, bool LightSampling>
+render_kernel pickVariance(const render_settings& settings) {
+	if (settings.adaptive || settings.time_budget > 0)
+		return pickBounces<DepthOfField, LightSampling, true>(settings);
+	return pickBounces<DepthOfField, LightSampling, false>(settings);
+}
 
-	//send pixeldata to output stream in order
-	int index = 0;
-	for (int j = 0; j < imageData.size(); j++)
-		for(int i = 0; i < imageData[j].size(); i++)
-			//this warning is a bit annoying
-			image[index++] = imageData[j][i];
+template <bool DepthOfField>
+render_kernel pickLightSampling(const render_settings& settings, const light_list& lights) {
+	if (lights.usable())
+		return pickVariance<DepthOfField, true>(settings);
+	return pickVariance<DepthOfField, false>(settings);
+}
 
-	//create .png file									 3 Channels: R, G and B, a fourth one would add the Alpha channel which is useless here
-	stbi_write_png("image.png", imageWidth, imageHeight, 3, image, imageWidth*3);
+render_kernel pickKernel(const render_settings& settings, const light_list& lights, const camera& cam) {
+	if (cam.depth_of_field())
+		return pickLightSampling<true>(settings, lights);
+	return pickLightSampling<false>(settings, lights);
 }
 
-std::vector<int> render(int imageWidth, int imageHeight_steps, int imageHeight, int j, const color& background, int samples, int bounces, const hittable_list& world, const camera& cam) {
-	std::vector<int> image;
-	auto scale = 1.0 / samples;
+void renderWorker(int worker, tile_scheduler& scheduler, render_kernel kernel, std::chrono::steady_clock::time_point deadline, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image) {
+	//tiles don't overlap, so every worker can add its samples straight to the framebuffer
+	//past the deadline the pass is left unfinished, the pixels that didn't get their samples just have fewer
+	tile t;
+	while (std::chrono::steady_clock::now() < deadline && scheduler.next(worker, t))
+		kernel(t, passSamples, active, background, settings, world, lights, cam, image);
+}
 
-	int new_height = imageHeight_steps * j;
-	int prev_height = imageHeight_steps * (j - 1);
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void render(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image) {
 	//do the render magic
-	for (int a = new_height - 1; a >= prev_height; --a) {
-		for (int b = 0; b < imageWidth; ++b) {
-			color pixelColor(0, 0, 0);
-			for (int s = 0; s < samples; ++s) {
-				auto u = (b + random_float()) / (imageWidth - 1);
-				auto v = (a + random_float()) / (imageHeight - 1);
-				ray r = cam.get_ray(u, v);
-				pixelColor += rayColor(r, background, world, bounces);
+	for (int a = t.y1 - 1; a >= t.y0; --a) {
+		for (int b = t.x0; b < t.x1; ++b) {
+			if (!active.empty() && !active[a * image.width + b])
+				continue;
+
+			//samples carry on numbering where the last pass stopped
+			auto first = image.samples(b, a);
+			for (int s = first; s < first + passSamples; ++s) {
+				//every sample gets its own random numbers, see sampler.h
+				start_pixel_sample(b, a, s);
+				float jitterX, jitterY;
+				random_float2(jitterX, jitterY);
+				auto u = (b + jitterX) / (image.width - 1);
+				auto v = (a + jitterY) / (image.height - 1);
+				ray r = cam.get_ray<DepthOfField>(u, v);
+				image.add<TrackVariance>(b, a, rayColor<MaxBounces, LightSampling>(r, background, world, lights, settings.bounces));
+			}
+		}
+	}
+}
+
+//the same as render, but all samples of the tile are traced as one wave
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void renderWavefront(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image) {
+	//every worker keeps its wave, so the arrays only get allocated for the first tile
+	thread_local path_wave wave;
+	wave.clear();
+
+	//generate
+	for (int a = t.y1 - 1; a >= t.y0; --a) {
+		for (int b = t.x0; b < t.x1; ++b) {
+			if (!active.empty() && !active[a * image.width + b])
+				continue;
+
+			auto first = image.samples(b, a);
+			for (int s = first; s < first + passSamples; ++s) {
+				auto i = wave.add_path(b, a, s);
+				float jitterX, jitterY;
+				random_float2(jitterX, jitterY);
+				auto u = (b + jitterX) / (image.width - 1);
+				auto v = (a + jitterY) / (image.height - 1);
+				wave.rays[i] = cam.get_ray<DepthOfField>(u, v);
+			}
+		}
+	}
+
+	wave.trace<MaxBounces, LightSampling>(background, world, lights, settings.bounces);
+
+	//paths went in pixel by pixel and sample by sample, they come out the same way
+	size_t i = 0;
+	for (int a = t.y1 - 1; a >= t.y0; --a) {
+		for (int b = t.x0; b < t.x1; ++b) {
+			if (!active.empty() && !active[a * image.width + b])
+				continue;
+			for (int s = 0; s < passSamples; ++s)
+				image.add<TrackVariance>(b, a, wave.radiance[i++]);
+		}
+	}
+}
+
+//the same as render, but the camera rays of every 4x4 block of pixels are traced as one packet, see wide_bvh::hit_packet
+template <bool DepthOfField, int MaxBounces, bool LightSampling, bool TrackVariance>
+void renderPackets(const tile& t, int passSamples, const std::vector<char>& active, const color& background, const render_settings& settings, const hittable& world, const light_list& lights, const camera& cam, framebuffer& image) {
+	const int block = 4;
+	static_assert(block * block <= ray_packet::max_size, "a block has to fit into one packet");
+
+	ray_packet packet;
+	int x[block * block], y[block * block], first[block * block];
+
+	for (int a0 = t.y1 - 1; a0 >= t.y0; a0 -= block) {
+		for (int b0 = t.x0; b0 < t.x1; b0 += block) {
+			//the pixels of the block that still get samples, and where their samples start
+			int count = 0;
+			for (int a = a0; a > a0 - block && a >= t.y0; --a) {
+				for (int b = b0; b < b0 + block && b < t.x1; ++b) {
+					if (!active.empty() && !active[a * image.width + b])
+						continue;
+					x[count] = b;
+					y[count] = a;
+					first[count] = image.samples(b, a);
+					count++;
+				}
 			}
 
-			//allocate pixels to output int vector
-			write_color_to_int(pixelColor, scale, image);
+			for (int s = 0; s < passSamples; ++s) {
+				packet.size = count;
+				for (int i = 0; i < count; i++) {
+					start_pixel_sample(x[i], y[i], first[i] + s);
+					float jitterX, jitterY;
+					random_float2(jitterX, jitterY);
+					auto u = (x[i] + jitterX) / (image.width - 1);
+					auto v = (y[i] + jitterY) / (image.height - 1);
+					packet.rays[i] = cam.get_ray<DepthOfField>(u, v);
+				}
+
+				world.hit_packet(packet, 0.001f);
+
+				for (int i = 0; i < count; i++) {
+					//starting the sample over and drawing the jitter again puts the sampler right where render has it after the camera ray
+					start_pixel_sample(x[i], y[i], first[i] + s);
+					float jitterX, jitterY;
+					random_float2(jitterX, jitterY);
+					image.add<TrackVariance>(x[i], y[i], rayColor<MaxBounces, LightSampling>(packet.rays[i], background, world, lights, settings.bounces, &packet, i));
+				}
+			}
 		}
 	}
-	return image;
-}
\ No newline at end of file
+}
@@ -8,11 +8,37 @@
 class aabb {
 public:
 	aabb() {}
-	aabb(const point3& a, const point3& b) {}
+	//a and b can be any two opposite corners
+	aabb(const point3& a, const point3& b)
+		: minimum(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z())),
+		  maximum(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()))
+	{}
 
 	point3 min() const { return minimum; }
 	point3 max() const { return maximum; }
 
+	point3 centroid() const { return 0.5f * (minimum + maximum); }
+
+	float surface_area() const {
+		auto d = maximum - minimum;
+		return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+	}
+
+	//flat boxes (axis aligned quads and triangles) would never get hit, give them some thickness.
+	//far from the origin delta is less than the gap between two floats and would just round away,
+	//so there the padding grows with the coordinates, a few float steps wide
+	aabb padded(float delta = 0.0001f) const {
+		aabb out = *this;
+		for (int a = 0; a < 3; a++) {
+			auto pad = fmax(delta, fmax(fabs(out.minimum[a]), fabs(out.maximum[a])) * 1e-6f);
+			if (out.maximum[a] - out.minimum[a] < pad) {
+				out.minimum[a] -= pad / 2;
+				out.maximum[a] += pad / 2;
+			}
+		}
+		return out;
+	}
+
 	bool hit(const ray& r, float t_min, float t_max) const {
 		for (int a = 0; a < 3; a++) {
 
@@ -0,0 +1,112 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//a std::vector that can also look at memory it doesn't own, like a memory mapped scene cache.
+//reads go through a plain pointer either way, anything that writes to a view copies it first
+template <typename T>
+class buffer {
+public:
+	buffer() {}
+	buffer(std::vector<T> v) : storage(std::move(v)) { sync(); }
+
+	buffer(const buffer& other) : storage(other.storage), external(other.external) {
+		if (external) { ptr = other.ptr; count = other.count; }
+		else sync();
+	}
+
+	buffer(buffer&& other) noexcept : storage(std::move(other.storage)), external(other.external) {
+		if (external) { ptr = other.ptr; count = other.count; }
+		else sync();
+		other.storage.clear();
+		other.external = false;
+		other.sync();
+	}
+
+	buffer& operator=(buffer other) {
+		swap(other);
+		return *this;
+	}
+
+	buffer& operator=(std::vector<T> v) {
+		storage = std::move(v);
+		external = false;
+		sync();
+		return *this;
+	}
+
+	//count elements at data, which has to stay alive for as long as the view is used
+	static buffer view(const T* data, size_t n) {
+		buffer b;
+		b.external = true;
+		b.ptr = const_cast<T*>(data);
+		b.count = n;
+		return b;
+	}
+
+	bool is_view() const { return external; }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	const T* data() const { return ptr; }
+	T* data() { own(); return ptr; }
+
+	const T& operator[](size_t i) const { return ptr[i]; }
+	T& operator[](size_t i) { own(); return ptr[i]; }
+
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+	T* begin() { own(); return ptr; }
+	T* end() { own(); return ptr + count; }
+
+	const T& back() const { return ptr[count - 1]; }
+	T& back() { own(); return ptr[count - 1]; }
+
+	void resize(size_t n) { own(); storage.resize(n); sync(); }
+	void reserve(size_t n) { own(); storage.reserve(n); sync(); }
+	void clear() { storage.clear(); external = false; sync(); }
+	void push_back(const T& value) { own(); storage.push_back(value); sync(); }
+
+	template <typename... Args>
+	T& emplace_back(Args&&... args) {
+		own();
+		storage.emplace_back(std::forward<Args>(args)...);
+		sync();
+		return storage.back();
+	}
+
+	void swap(buffer& other) {
+		storage.swap(other.storage);
+		std::swap(external, other.external);
+		std::swap(ptr, other.ptr);
+		std::swap(count, other.count);
+		if (!external) sync();
+		if (!other.external) other.sync();
+	}
+
+private:
+	void sync() {
+		ptr = storage.data();
+		count = storage.size();
+	}
+
+	//turns a view into a copy before it gets written to
+	void own() {
+		if (!external)
+			return;
+		storage.assign(ptr, ptr + count);
+		external = false;
+		sync();
+	}
+
+	std::vector<T> storage;
+	T* ptr = nullptr;
+	size_t count = 0;
+	bool external = false;
+};
+
+#endif // !BUFFER_H
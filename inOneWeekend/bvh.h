@@ -7,9 +7,121 @@
 #include "hittable_list.h"
 #include "ray.h"
 
+//what the builder needs to know about an object: its box, the box center and where it came from
+struct bvh_primitive {
+	aabb box;
+	point3 centroid;
+	size_t index;
+};
+
+std::vector<bvh_primitive> bvh_primitives(const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+	float time0, float time1) {
+	std::vector<bvh_primitive> prims;
+	prims.reserve(end - start);
+
+	for (size_t i = start; i < end; i++) {
+		aabb box;
+		if (!objects[i]->bounding_box(time0, time1, box))
+			std::cerr << "No bounding box in bvh_node constructor.\n";
+		prims.push_back({ box, box.centroid(), i });
+	}
+	return prims;
+}
+
+//surface area heuristic: the chance of a ray hitting a child is proportional to its surface area,
+//so the best split minimizes area * primitive count summed over both children.
+//instead of trying every primitive as a split, the centroids are dropped into a few bins per axis
+//and only the bin borders are tried, which keeps the build linear per level
+const int sah_bins = 16;
+
+struct sah_split {
+	int axis = -1;
+	int bin = 0;
+	float cost = infinity;
+};
+
+sah_split find_sah_split(const std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& centroid_bounds) {
+	struct bin {
+		aabb box;
+		size_t count = 0;
+	};
+
+	sah_split best;
+
+	for (int axis = 0; axis < 3; axis++) {
+		auto lo = centroid_bounds.min()[axis];
+		auto extent = centroid_bounds.max()[axis] - lo;
+		if (extent <= 0)
+			continue; //all centroids on one plane, nothing to split here
+
+		bin bins[sah_bins];
+		auto scale = sah_bins / extent;
+		for (size_t i = start; i < end; i++) {
+			int b = std::min(static_cast<int>((prims[i].centroid[axis] - lo) * scale), sah_bins - 1);
+			bins[b].box = bins[b].count ? surrounding_box(bins[b].box, prims[i].box) : prims[i].box;
+			bins[b].count++;
+		}
+
+		//sweep from the right to get the area and count of everything right of each border...
+		float right_area[sah_bins];
+		size_t right_count[sah_bins];
+		aabb acc;
+		size_t count = 0;
+		for (int b = sah_bins - 1; b > 0; b--) {
+			if (bins[b].count) {
+				acc = count ? surrounding_box(acc, bins[b].box) : bins[b].box;
+				count += bins[b].count;
+			}
+			right_area[b] = count ? acc.surface_area() : 0;
+			right_count[b] = count;
+		}
+
+		//...then from the left and evaluate every border on the way
+		count = 0;
+		for (int b = 0; b < sah_bins - 1; b++) {
+			if (bins[b].count) {
+				acc = count ? surrounding_box(acc, bins[b].box) : bins[b].box;
+				count += bins[b].count;
+			}
+			if (count == 0 || right_count[b + 1] == 0)
+				continue;
+
+			auto cost = acc.surface_area() * count + right_area[b + 1] * right_count[b + 1];
+			if (cost < best.cost) {
+				best.axis = axis;
+				best.bin = b;
+				best.cost = cost;
+			}
+		}
+	}
+	return best;
+}
+
+//splits prims[start, end) in two and returns the first index of the right half
+size_t partition_primitives(std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& centroid_bounds, const sah_split& split) {
+	if (split.axis < 0) {
+		//every centroid is in the same spot, any split is as good as the other
+		return start + (end - start) / 2;
+	}
+
+	auto lo = centroid_bounds.min()[split.axis];
+	auto scale = sah_bins / (centroid_bounds.max()[split.axis] - lo);
+	auto mid = std::partition(prims.begin() + start, prims.begin() + end, [&](const bvh_primitive& p) {
+		return std::min(static_cast<int>((p.centroid[split.axis] - lo) * scale), sah_bins - 1) <= split.bin;
+	});
+	return mid - prims.begin();
+}
+
+aabb centroid_bounds(const std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+	aabb bounds(prims[start].centroid, prims[start].centroid);
+	for (size_t i = start + 1; i < end; i++)
+		bounds = surrounding_box(bounds, aabb(prims[i].centroid, prims[i].centroid));
+	return bounds;
+}
+
 class bvh_node : public hittable {
-public: 
-	bvh_node();
+public:
+	bvh_node() {}
 	bvh_node(const hittable_list& list, float time0, float time1)
 		: bvh_node(list.objects, 0, list.objects.size(), time0, time1) {}
 
@@ -23,6 +135,9 @@ public:
 	shared_ptr<hittable> left;
 	shared_ptr<hittable> right;
 	aabb box;
+
+private:
+	bvh_node(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims, size_t start, size_t end);
 };
 
 bool bvh_node::bounding_box(float time0, float time1, aabb& output_box) const {
@@ -33,6 +148,9 @@ bool bvh_node::bounding_box(float time0, float time1, aabb& output_box) const {
 bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 	if (!box.hit(r, t_min, t_max)) return false;
 
+	if (left == right)
+		return left->hit(r, t_min, t_max, rec);
+
 	bool hit_left = left->hit(r, t_min, t_max, rec);
 	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
@@ -41,62 +159,42 @@ bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 
 bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end,
 	float time0, float time1) {
-	auto objects = src_objects;
+	if (start == end) {
+		std::cerr << "Empty bvh_node.\n";
+		return;
+	}
 
-	int axis = random_int(0, 2);
-	auto comparator = (axis == 0) ? box_x_compare
-					: (axis == 1) ? box_y_compare
-					: box_z_compare;
+	//the boxes are computed once up front, the recursion only shuffles these around
+	auto prims = bvh_primitives(src_objects, start, end, time0, time1);
+	*this = bvh_node(src_objects, prims, 0, prims.size());
+}
 
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims, size_t start, size_t end) {
 	size_t object_span = end - start;
 
 	if (object_span == 1) {
-		left = right = objects[start];
+		left = right = objects[prims[start].index];
+		box = prims[start].box;
+		return;
 	}
-	else if (object_span == 2) {
-		if (comparator(objects[start], objects[start + 1])) {
-			left = objects[start];
-			right = objects[start + 1];
-		}
-		else {
-			left = objects[start + 1];
-			right = objects[start];
-		}
+
+	if (object_span == 2) {
+		left = objects[prims[start].index];
+		right = objects[prims[start + 1].index];
 	}
 	else {
-		std::sort(objects.begin() + start, objects.begin() + end, comparator);
+		auto bounds = centroid_bounds(prims, start, end);
+		auto mid = partition_primitives(prims, start, end, bounds, find_sah_split(prims, start, end, bounds));
 
-		auto mid = start + object_span / 2;
-		left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-		right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+		left = make_shared<bvh_node>(bvh_node(objects, prims, start, mid));
+		right = make_shared<bvh_node>(bvh_node(objects, prims, mid, end));
 	}
 
 	aabb box_left, box_right;
+	left->bounding_box(0, 0, box_left);
+	right->bounding_box(0, 0, box_right);
 
 	box = surrounding_box(box_left, box_right);
 }
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
-	aabb box_a;
-	aabb box_b;
-
-	if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
-		std::cerr << "No bounding box in bvh_node constructor.\n";
-
-	return box_a.min().e[axis] < box_b.min().e[axis];
-}
-
-
-bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-	return box_compare(a, b, 0);
-}
-
-bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-	return box_compare(a, b, 1);
-}
-
-bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-	return box_compare(a, b, 2);
-}
-
 #endif // !BVH_H
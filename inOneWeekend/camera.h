@@ -35,7 +35,14 @@ public:
         lens_radius = lensRadius;
     };
 
-    ray get_ray(double s, double t) const {
+    bool depth_of_field() const { return lens_radius > 0; }
+
+    //DepthOfField false skips the lens and shoots every ray from the same point, for when lens_radius is 0
+    template <bool DepthOfField = true>
+    ray get_ray(float s, float t) const {
+        if (!DepthOfField)
+            return ray(origin, lower_left_corner + s * horizontal + t * vertical - origin);
+
         vec3 rd = lens_radius * random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
 
@@ -56,28 +63,4 @@ private:
     float viewport_width;
 };
 
-//clamp
-inline float clamp(float x, float min, float max) {
-    if (x < min) return min;
-    if (x > max) return max;
-    return x;
-}
-
-//spooky function name with even spookier code, happy halloween
-void write_color_to_int(color pixel_color, float scale, std::vector<int> &out) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Divide the color by the number of samples.
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
-
-    // Write the translated [0,255] value of each color component.
-    out.push_back(static_cast<int>(256 * clamp(r, 0.0, 0.999)));
-    out.push_back(static_cast<int>(256 * clamp(g, 0.0, 0.999)));
-    out.push_back(static_cast<int>(256 * clamp(b, 0.0, 0.999)));
-}
-
 #endif // !CAMERA_H
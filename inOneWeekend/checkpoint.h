@@ -0,0 +1,113 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "framebuffer.h"
+
+//a render in progress saved to disk: the float sums, the sample counts and variances of every pixel and how far the passes got.
+//the random numbers don't need saving, every pixel sample reseeds its sampler from the seed, the pixel and the sample index
+//(see sampler.h), so the next sample of a pixel gets the same numbers whether the render was stopped in between or not
+
+//bump whenever the layout of the file changes
+const uint32_t checkpoint_version = 1;
+
+namespace checkpoint_detail {
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t pad;
+		uint64_t key;
+		int32_t width, height;
+		int32_t done;			//samples per pixel the finished passes went up to
+		int32_t pad2;
+	};
+}
+
+class render_checkpoint {
+public:
+	//key has to change whenever anything that changes the image does: scene, camera, seed, sampler, settings
+	render_checkpoint(const char* file, uint64_t key) : filename(file), key(key) {}
+
+	//fills image and done with the saved render, false if there is none or it belongs to a different one
+	bool load(framebuffer& image, int& done) const;
+
+	//replaces the last checkpoint, a crash while writing leaves the previous one untouched
+	bool save(const framebuffer& image, int done) const;
+
+private:
+	std::string filename;
+	uint64_t key;
+};
+
+bool render_checkpoint::load(framebuffer& image, int& done) const {
+	using namespace checkpoint_detail;
+
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+
+	header h;
+	if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || memcmp(h.magic, "RTCHECK", 8) != 0 || h.version != checkpoint_version) {
+		std::cerr << "Ignoring checkpoint " << filename << ", it isn't one.\n";
+		return false;
+	}
+	if (h.key != key || h.width != image.width || h.height != image.height) {
+		std::cerr << "Ignoring checkpoint " << filename << ", it belongs to a different render.\n";
+		return false;
+	}
+
+	in.read(reinterpret_cast<char*>(image.sums.data()), image.sums.size() * sizeof(color));
+	in.read(reinterpret_cast<char*>(image.variances.data()), image.variances.size() * sizeof(pixel_variance));
+	if (!in) {
+		//might have been filled halfway, start over from nothing
+		std::cerr << "Ignoring checkpoint " << filename << ", it's cut off.\n";
+		image = framebuffer(image.width, image.height);
+		return false;
+	}
+
+	done = h.done;
+	return true;
+}
+
+bool render_checkpoint::save(const framebuffer& image, int done) const {
+	using namespace checkpoint_detail;
+
+	header h = {};
+	memcpy(h.magic, "RTCHECK", 8);
+	h.version = checkpoint_version;
+	h.key = key;
+	h.width = image.width;
+	h.height = image.height;
+	h.done = done;
+
+	//same as the scene cache: written next to the real file and renamed once it's complete
+	auto temp = filename + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		out.write(reinterpret_cast<const char*>(image.sums.data()), image.sums.size() * sizeof(color));
+		out.write(reinterpret_cast<const char*>(image.variances.data()), image.variances.size() * sizeof(pixel_variance));
+		out.flush();
+		if (!out) {
+			std::cerr << "Could not write checkpoint '" << temp << "'.\n";
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(temp, filename, ec);
+	if (ec) {
+		std::cerr << "Could not write checkpoint '" << filename << "'.\n";
+		return false;
+	}
+	return true;
+}
+
+#endif // !CHECKPOINT_H
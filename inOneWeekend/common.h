@@ -6,6 +6,18 @@
 #include <memory>
 #include <cstdlib>
 
+#include "random.h"
+#include "sampler.h"
+
+//sse is there on every x64 cpu, the bvh and (optionally) vec3 use it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_HAS_SSE 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
 // https://github.com/nothings/stb
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -27,9 +39,29 @@ inline float degreesToRadians(float degrees) {
 	return degrees * (pi / 180);
 }
 
+inline float clamp(float x, float min, float max) {
+	if (x < min) return min;
+	if (x > max) return max;
+	return x;
+}
+
 inline float random_float() {
-	//returns a random float from 0 to <1
-	return rand() / (RAND_MAX + 1.0f);
+	//returns a random float from 0 to <1, the next dimension of the pixel sample the calling thread is on
+	auto s = current_sampler();
+	return s ? s->next_1d() : thread_rng().next_float();
+}
+
+//two random floats meant to be used together (a point on the pixel, the lens or a light, a direction),
+//a sampler can spread those pairs out evenly in 2d
+inline void random_float2(float& a, float& b) {
+	auto s = current_sampler();
+	if (s) {
+		s->next_2d(a, b);
+	}
+	else {
+		a = thread_rng().next_float();
+		b = thread_rng().next_float();
+	}
 }
 inline float random_float(float min, float max) {
 	return min + (max - min) * random_float();
@@ -0,0 +1,95 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <vector>
+
+#include "vec3.h"
+
+//running mean and variance of a pixel's brightness (Welford), adaptive sampling stops a pixel when it's converged
+struct pixel_variance {
+	int count = 0;
+	float mean = 0;
+	float m2 = 0;
+
+	void add(const color& c) {
+		auto y = 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+		count++;
+		auto delta = y - mean;
+		mean += delta / count;
+		m2 += delta * (y - mean);
+	}
+
+	//the image gets written as sqrt(value), so an error of e turns into about e / (2 sqrt(mean)) on screen
+	bool converged(float threshold) const {
+		if (count < 2)
+			return false;
+		auto error = sqrt(m2 / (count - 1) / count);
+		return error <= threshold * 2 * sqrt(std::max(mean, 1e-4f));
+	}
+};
+
+//linear light summed up per pixel plus how many samples went into it.
+//nothing gets rounded until resolve, so more samples can always be added on top.
+//rows are stored bottom up like the camera's v, resolve flips them for the png
+class framebuffer {
+public:
+	framebuffer(int w, int h) : width(w), height(h), sums(w * h), variances(w * h), output(w * h * 3) {}
+
+	//without TrackVariance only the sample count is kept, for renders that never look at the noise
+	template <bool TrackVariance = true>
+	void add(int x, int y, const color& c) {
+		auto i = y * width + x;
+		sums[i] += c;
+		if (TrackVariance)
+			variances[i].add(c);
+		else
+			variances[i].count++;
+	}
+
+	int samples(int x, int y) const { return variances[y * width + x].count; }
+
+	//gamma 2 and 8 bits per channel, top row first. fills output and returns it,
+	//the rows are split between the workers and every value only gets touched once
+	const unsigned char* resolve(int workerCount = 1);
+
+public:
+	int width;
+	int height;
+	std::vector<color> sums;
+	std::vector<pixel_variance> variances;
+	std::vector<unsigned char> output;	//what resolve writes to, allocated once with the framebuffer
+
+private:
+	void resolve_rows(int y0, int y1);
+};
+
+const unsigned char* framebuffer::resolve(int workerCount) {
+	workerCount = std::max(std::min(workerCount, height), 1);
+	std::vector<std::future<void>> ftr;
+	for (int worker = 1; worker < workerCount; worker++)
+		ftr.push_back(std::async(std::launch::async, &framebuffer::resolve_rows, this, height * worker / workerCount, height * (worker + 1) / workerCount));
+	resolve_rows(0, height / workerCount);
+
+	for (auto& f : ftr)
+		f.get();
+	return output.data();
+}
+
+void framebuffer::resolve_rows(int y0, int y1) {
+	for (int y = y0; y < y1; y++) {
+		auto row = output.data() + (height - 1 - y) * width * 3;
+		for (int x = 0; x < width; x++) {
+			auto i = y * width + x;
+			auto scale = variances[i].count > 0 ? 1.0f / variances[i].count : 0.0f;
+			for (int c = 0; c < 3; c++) {
+				auto value = sqrt(scale * sums[i][c]);
+				row[3 * x + c] = static_cast<unsigned char>(256 * std::min(std::max(value, 0.0f), 0.999f));
+			}
+		}
+	}
+}
+
+#endif // !FRAMEBUFFER_H
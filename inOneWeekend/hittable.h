@@ -5,15 +5,17 @@
 #include "ray.h"
 #include "aabb.h"
 
-class material;
+#include <cstdint>
+#include <type_traits>
 
+//plain data, gets copied around every time something closer is hit
 struct hit_record {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
 	float t;
 	float u;
 	float v;
+	uint32_t mat_id;	//index into scene_materials()
 	bool front_face;
 
 	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -22,10 +24,38 @@ struct hit_record {
 	}
 };
 
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record should stay plain data");
+
+//camera rays for a small block of pixels, traced through the scene together
+struct ray_packet {
+	static const int max_size = 16;
+
+	int size = 0;
+	ray rays[max_size];
+	hit_record recs[max_size];
+	uint32_t hits = 0;		//one bit per ray that hit something
+
+	//false if ray i missed, otherwise copies what it hit
+	bool hit(int i, hit_record& rec) const {
+		if (!(hits & (1u << i)))
+			return false;
+		rec = recs[i];
+		return true;
+	}
+};
+
 class hittable {
 public:
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
 	virtual bool bounding_box(float time0, float time1, aabb& output_box) const = 0;
+
+	//traces every ray of the packet from t_min on, one after the other unless something knows better
+	virtual void hit_packet(ray_packet& packet, float t_min) const {
+		packet.hits = 0;
+		for (int i = 0; i < packet.size; i++)
+			if (hit(packet.rays[i], t_min, infinity, packet.recs[i]))
+				packet.hits |= 1u << i;
+	}
 };
 
 #endif // !HITTABLE_H
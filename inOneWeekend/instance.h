@@ -0,0 +1,180 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+#include "aabb.h"
+#include "common.h"
+#include "hittable.h"
+#include "material_table.h"
+
+//a 3x4 matrix: the linear part in the first three columns, the translation in the last one
+struct affine {
+	float m[3][4];
+
+	static affine identity() { return basis(point3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)); }
+	static affine translate(const vec3& offset) { return basis(offset, vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)); }
+	static affine scale(const vec3& f) { return basis(point3(0, 0, 0), vec3(f.x(), 0, 0), vec3(0, f.y(), 0), vec3(0, 0, f.z())); }
+	static affine scale(float f) { return scale(vec3(f, f, f)); }
+	static affine rotate(const vec3& axis, float degrees);
+
+	//maps the unit vectors to x, y and z and the origin to origin
+	static affine basis(const point3& origin, const vec3& x, const vec3& y, const vec3& z) {
+		affine a;
+		for (int r = 0; r < 3; r++) {
+			a.m[r][0] = x[r];
+			a.m[r][1] = y[r];
+			a.m[r][2] = z[r];
+			a.m[r][3] = origin[r];
+		}
+		return a;
+	}
+
+	point3 point(const point3& p) const {
+		return point3(
+			m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+			m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+			m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+	}
+
+	//the linear part transposed times n. normals go from one space to the other with the transpose of the inverse,
+	//so called on the inverse transform this moves a normal the same way vector moves a direction on this one
+	vec3 normal(const vec3& n) const {
+		return vec3(
+			m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+			m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+			m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+	}
+
+	float determinant() const {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	//only call this if the determinant isn't 0
+	affine inverse() const;
+
+	//the box around the transformed corners of b
+	aabb box(const aabb& b) const;
+};
+
+//b first, then a
+inline affine operator*(const affine& a, const affine& b) {
+	affine out;
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 4; c++) {
+			out.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c];
+			if (c == 3)
+				out.m[r][c] += a.m[r][3];
+		}
+	}
+	return out;
+}
+
+//Rodrigues' rotation formula written out as a matrix, counterclockwise looking down the axis
+inline affine affine::rotate(const vec3& axis, float degrees) {
+	auto k = unit_vector(axis);
+	auto theta = degreesToRadians(degrees);
+	auto c = cos(theta), s = sin(theta), t = 1 - c;
+	return basis(point3(0, 0, 0),
+		vec3(t * k.x() * k.x() + c, t * k.x() * k.y() + s * k.z(), t * k.x() * k.z() - s * k.y()),
+		vec3(t * k.x() * k.y() - s * k.z(), t * k.y() * k.y() + c, t * k.y() * k.z() + s * k.x()),
+		vec3(t * k.x() * k.z() + s * k.y(), t * k.y() * k.z() - s * k.x(), t * k.z() * k.z() + c));
+}
+
+inline affine affine::inverse() const {
+	//adjugate over determinant for the linear part, the translation gets moved back through it
+	auto inv_det = 1 / determinant();
+	affine out;
+	out.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+	out.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+	out.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+	out.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+	out.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+	out.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+	out.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+	out.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+	out.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+	for (int r = 0; r < 3; r++)
+		out.m[r][3] = -(out.m[r][0] * m[0][3] + out.m[r][1] * m[1][3] + out.m[r][2] * m[2][3]);
+	return out;
+}
+
+inline aabb affine::box(const aabb& b) const {
+	aabb out;
+	for (int corner = 0; corner < 8; corner++) {
+		point3 p(corner & 1 ? b.max().x() : b.min().x(), corner & 2 ? b.max().y() : b.min().y(), corner & 4 ? b.max().z() : b.min().z());
+		p = point(p);
+		out = corner ? surrounding_box(out, aabb(p, p)) : aabb(p, p);
+	}
+	return out;
+}
+
+//the same object placed somewhere else: rays get moved into the object's space instead of the object into the world.
+//scenes that repeat geometry build it once (with make_blas for anything bigger than a few pieces, see wide_bvh.h)
+//and add as many instances of it to the world as they like, build_bvh over the world then makes the top level bvh.
+//small instances like boxes get copied into world space when the top level is built, see primitive_store::flatten.
+//lights inside the other instances can't be sampled directly, so one of them with an emissive material anywhere in it
+//turns light sampling off for the whole scene and every light is left to be found by bounces (see light_list)
+class instance : public hittable {
+public:
+	//material_override for keeping the materials the object was built with
+	static const uint32_t keep_materials = UINT32_MAX;
+
+	instance() {}
+	//to_world has to be invertible
+	instance(shared_ptr<hittable> object, const affine& to_world, uint32_t material_override = keep_materials)
+		: object(std::move(object)), to_world(to_world), to_object(to_world.inverse()), material_override(material_override) {
+		aabb local;
+		if (!this->object->bounding_box(0, 0, local))
+			std::cerr << "No bounding box in instance constructor.\n";
+		world_box = to_world.box(local).padded();
+	}
+	//everything in the instance gets material m
+	instance(shared_ptr<hittable> object, const affine& to_world, shared_ptr<material> m)
+		: instance(std::move(object), to_world, scene_materials().add(m)) {}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+	//the material a piece built with mat_id ends up with
+	uint32_t piece_material(uint32_t mat_id) const { return material_override == keep_materials ? mat_id : material_override; }
+
+public:
+	shared_ptr<hittable> object;
+	affine to_world;
+	affine to_object;
+	aabb world_box;
+	uint32_t material_override = keep_materials;
+};
+
+inline bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	//the direction isn't normalized, so t means the same in both spaces and t_min and t_max carry over as they are
+	ray local(to_object.point(r.origin()), to_object.vector(r.direction()));
+	if (!object->hit(local, t_min, t_max, rec))
+		return false;
+
+	//the normal already faces against the local ray, the transpose of the inverse keeps it that way
+	rec.p = r.at(rec.t);
+	rec.normal = unit_vector(to_object.normal(rec.normal));
+	rec.mat_id = piece_material(rec.mat_id);
+	return true;
+}
+
+inline bool instance::bounding_box(float time0, float time1, aabb& output_box) const {
+	output_box = world_box;
+	return true;
+}
+
+#endif // !INSTANCE_H
@@ -0,0 +1,226 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "material_table.h"
+
+//a point picked on one of the lights
+struct light_sample {
+	hit_record rec;		//point, normal, uv and material at the sampled point
+	float pdf_area;		//probability density per unit of area
+	bool two_sided;		//triangles only get hit from the front, quads and spheres from both sides
+};
+
+bool object_may_emit(const shared_ptr<hittable>& object, std::unordered_map<const hittable*, bool>& known);
+
+//whether anything in the instance might glow. lights inside instances can't be sampled, they only get found by bounces.
+//scenes place the same object many times, known remembers the answer for every object that has been looked through already
+bool may_emit(const instance& inst, std::unordered_map<const hittable*, bool>& known) {
+	if (inst.material_override != instance::keep_materials)
+		return scene_materials()[inst.material_override].is_emissive();
+
+	auto it = known.find(inst.object.get());
+	if (it != known.end())
+		return it->second;
+	auto emits = object_may_emit(inst.object, known);
+	known[inst.object.get()] = emits;
+	return emits;
+}
+
+bool object_may_emit(const shared_ptr<hittable>& object, std::unordered_map<const hittable*, bool>& known) {
+	auto pieces = bvh_primitives(*object);
+	primitive_store local;
+	if (!pieces) {
+		local.add(object);
+		pieces = &local;
+	}
+
+	auto emissive = [](uint32_t id) { return scene_materials()[id].is_emissive(); };
+	//nobody knows what's in the others
+	if (!pieces->others.empty())
+		return true;
+	for (const auto& s : pieces->spheres)
+		if (emissive(s.mat_id)) return true;
+	for (const auto& q : pieces->quads)
+		if (emissive(q.mat_id)) return true;
+	for (const auto& t : pieces->triangles)
+		if (emissive(t.mat_id)) return true;
+	for (const auto& mesh : pieces->meshes)
+		for (auto id : mesh->material_ids)
+			if (emissive(id)) return true;
+	for (const auto& inner : pieces->instances)
+		if (may_emit(inner, known)) return true;
+	return false;
+}
+
+//every primitive with an emissive material, picked proportional to area.
+//that way each point on any light is equally likely and the pdf is just 1 / total area
+class light_list {
+public:
+	light_list() {}
+	light_list(const primitive_store& p);
+
+	bool sample(light_sample& out) const;
+
+	//lights only get sampled if every emitter in the scene is in here,
+	//otherwise diffuse bounces would skip the ones that aren't
+	bool usable() const { return complete && !refs.empty(); }
+
+	size_t size() const { return refs.size(); }
+
+	//density of sample picking a point on a light, per unit solid angle as seen from distance_squared away
+	float pdf(float distance_squared, float light_cosine) const {
+		return distance_squared / (light_cosine * total_area);
+	}
+
+private:
+	const primitive_store* prims = nullptr;
+	std::vector<uint32_t> refs;
+	std::vector<float> cdf;		//running sum of the areas
+	float total_area = 0;
+	bool complete = false;
+};
+
+light_list::light_list(const primitive_store& p) : prims(&p), complete(p.others.empty()) {
+	auto emissive = [](uint32_t id) { return scene_materials()[id].is_emissive(); };
+	std::unordered_map<const hittable*, bool> instance_objects;
+
+	for (auto ref : p.refs) {
+		auto i = primitive_store::ref_index(ref);
+		float area = 0;
+		switch (primitive_store::ref_type(ref)) {
+		case primitive_store::sphere_type:		if (emissive(p.spheres[i].mat_id)) area = p.spheres[i].area(); break;
+		case primitive_store::quad_type:		if (emissive(p.quads[i].mat_id)) area = p.quads[i].area(); break;
+		case primitive_store::triangle_type:	if (emissive(p.triangles[i].mat_id)) area = p.triangles[i].area(); break;
+		case primitive_store::mesh_face_type: {
+			auto mesh = p.mesh_of_face(i);
+			auto face = i - p.mesh_first_face[mesh];
+			if (emissive(p.meshes[mesh]->face_material(face)))
+				area = p.meshes[mesh]->face_area(face);
+			break;
+		}
+		case primitive_store::instance_type:
+			if (may_emit(p.instances[i], instance_objects))
+				complete = false;
+			break;
+		default:
+			break;
+		}
+
+		if (area > 0) {
+			total_area += area;
+			refs.push_back(ref);
+			cdf.push_back(total_area);
+		}
+	}
+
+	if (!complete && !refs.empty())
+		std::cerr << "Light sampling is off, the scene has objects whose light can't be sampled.\n";
+}
+
+bool light_list::sample(light_sample& out) const {
+	if (refs.empty())
+		return false;
+
+	auto pick = std::upper_bound(cdf.begin(), cdf.end(), random_float() * total_area) - cdf.begin();
+	auto ref = refs[std::min(static_cast<size_t>(pick), refs.size() - 1)];
+	auto i = primitive_store::ref_index(ref);
+	float s, t;
+	random_float2(s, t);
+
+	out.two_sided = true;
+	switch (primitive_store::ref_type(ref)) {
+	case primitive_store::sphere_type:		prims->spheres[i].sample_surface(s, t, out.rec); break;
+	case primitive_store::quad_type:		prims->quads[i].sample_surface(s, t, out.rec); break;
+	case primitive_store::triangle_type:
+		prims->triangles[i].sample_surface(s, t, out.rec);
+		out.two_sided = false;
+		break;
+	default: {
+		auto mesh = prims->mesh_of_face(i);
+		prims->meshes[mesh]->sample_face(i - prims->mesh_first_face[mesh], s, t, out.rec);
+		out.two_sided = false;
+		break;
+	}
+	}
+
+	out.pdf_area = 1 / total_area;
+	return true;
+}
+
+//weight for a sample that could have come from two strategies, whichever was more likely to find it gets most of it.
+//squaring (the power heuristic) cuts down fireflies from the unlikely one a bit more than plain pdf ratios do
+inline float power_heuristic(float pdf, float other_pdf) {
+	auto a = pdf * pdf;
+	auto b = other_pdf * other_pdf;
+	return a + b > 0 ? a / (a + b) : 0;
+}
+
+//picks a random point on the lights and works out the light arriving from it, divided by how likely that point was.
+//rec is a point on a non specular surface. false if the point can't add anything, otherwise it only counts
+//if shadow gets from rec to the light without hitting anything before max_t.
+//the bounce that follows can also find the same light, the two are weighted against each other
+bool light_connection(const ray& r_in, const hit_record& rec, const material_data& mat, const light_list& lights, ray& shadow, float& max_t, color& contribution) {
+	light_sample light;
+	if (!lights.sample(light))
+		return false;
+
+	auto to_light = light.rec.p - rec.p;
+	auto distance_squared = to_light.length_squared();
+	auto distance = sqrt(distance_squared);
+	auto direction = to_light / distance;
+
+	if (dot(direction, rec.normal) <= 0)
+		return false;
+
+	auto light_cosine = -dot(direction, light.rec.normal);
+	if (light.two_sided)
+		light_cosine = fabs(light_cosine);
+	if (light_cosine <= 0)
+		return false;
+
+	//stop just short of the light so it doesn't shadow itself
+	shadow = ray(rec.p, direction);
+	max_t = distance * 0.999f;
+
+	color attenuation;
+	ray scattered;
+	color emitted;
+	if (!scene_materials()[light.rec.mat_id].emitted(shadow, light.rec, attenuation, scattered, emitted))
+		return false;
+
+	auto f = mat.eval(r_in, rec, direction);
+	if (f.near_zero())
+		return false;
+
+	auto light_pdf = lights.pdf(distance_squared, light_cosine);
+	auto weight = power_heuristic(light_pdf, mat.pdf(r_in, rec, direction));
+	contribution = f * emitted * (weight / light_pdf);
+	return true;
+}
+
+//light_connection with the shadow ray traced right away
+color direct_light(const ray& r_in, const hit_record& rec, const material_data& mat, const light_list& lights, const hittable& world) {
+	ray shadow;
+	float max_t;
+	color contribution;
+	if (!light_connection(r_in, rec, mat, lights, shadow, max_t, contribution))
+		return color(0, 0, 0);
+
+	//anything in between the two points casts a shadow
+	hit_record blocker;
+	if (world.hit(shadow, 0.001, max_t, blocker))
+		return color(0, 0, 0);
+	return contribution;
+}
+
+#endif // !LIGHTS_H
@@ -0,0 +1,431 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer.h"
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "quad.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+
+class primitive_store;
+//the primitives of a bvh made by build_bvh, nullptr for anything else (see wide_bvh.h)
+const primitive_store* bvh_primitives(const hittable& bvh);
+
+//the scene's primitives copied into one array per type, so hitting one is a switch and a direct call
+//instead of a pointer chase and a virtual call. anything that isn't a known type ends up in "others"
+class primitive_store {
+public:
+	enum type : uint32_t { sphere_type, quad_type, triangle_type, mesh_face_type, other_type, instance_type };
+
+	//a reference is the type in the top 3 bits and the index into that type's array in the rest,
+	//so there can't be more than max_ref_index + 1 of one type (see push_ref)
+	static const uint32_t max_ref_index = 0x1fffffff;
+	static uint32_t make_ref(type t, size_t index) { return (static_cast<uint32_t>(t) << 29) | static_cast<uint32_t>(index); }
+	static type ref_type(uint32_t ref) { return static_cast<type>(ref >> 29); }
+	static uint32_t ref_index(uint32_t ref) { return ref & max_ref_index; }
+
+	//the pieces of every object instanced so far that isn't a bvh, nullptr if there are too many to flatten.
+	//the same object placed many times only gets taken apart once
+	using instanced_pieces = std::unordered_map<const hittable*, shared_ptr<const primitive_store>>;
+
+	//lists, bvh nodes, small instances and meshes get taken apart so the bvh sees their individual pieces.
+	//adding several objects to one store should share known
+	void add(const shared_ptr<hittable>& object) { instanced_pieces known; add(object, known); }
+	void add(const shared_ptr<hittable>& object, instanced_pieces& known);
+	//numbers the faces of a mesh without adding refs for them, false if there are too many faces
+	bool add_mesh(const shared_ptr<triangle_mesh>& mesh);
+
+	bool hit(uint32_t ref, const ray& r, float t_min, float t_max, hit_record& rec) const;
+	aabb bounding_box(uint32_t ref) const;
+
+	size_t size() const { return refs.size(); }
+	size_t mesh_of_face(uint32_t face) const { return face_mesh[face]; }
+
+public:
+	buffer<uint32_t> refs;
+	std::vector<sphere> spheres;
+	std::vector<quad> quads;
+	std::vector<triangle> triangles;
+	std::vector<shared_ptr<hittable>> others;
+	std::vector<instance> instances;
+
+	//mesh faces are numbered across all meshes, mesh_first_face says where each mesh starts
+	//and face_mesh which mesh each face belongs to, so hitting a face doesn't have to search for it
+	std::vector<shared_ptr<triangle_mesh>> meshes;
+	std::vector<uint32_t> mesh_first_face;
+	std::vector<uint32_t> face_mesh;
+	uint32_t mesh_face_total = 0;
+
+private:
+	bool flatten(const instance& inst, instanced_pieces& known);
+	//false and nothing added if index doesn't fit into a ref
+	bool push_ref(type t, size_t index);
+};
+
+inline bool primitive_store::push_ref(type t, size_t index) {
+	if (index > max_ref_index) {
+		if (index == max_ref_index + 1)
+			std::cerr << "Too many primitives of one type in the bvh, the rest are left out.\n";
+		return false;
+	}
+	refs.push_back(make_ref(t, index));
+	return true;
+}
+
+bool primitive_store::add_mesh(const shared_ptr<triangle_mesh>& mesh) {
+	if (mesh->face_count() > static_cast<size_t>(max_ref_index) + 1 - mesh_face_total) {
+		std::cerr << "Too many mesh faces in the bvh, leaving a mesh out.\n";
+		return false;
+	}
+	mesh_first_face.push_back(mesh_face_total);
+	face_mesh.resize(face_mesh.size() + mesh->face_count(), static_cast<uint32_t>(meshes.size()));
+	meshes.push_back(mesh);
+	mesh_face_total += static_cast<uint32_t>(mesh->face_count());
+	return true;
+}
+
+void primitive_store::add(const shared_ptr<hittable>& object, instanced_pieces& known) {
+	if (auto list = dynamic_cast<const hittable_list*>(object.get())) {
+		for (const auto& o : list->objects)
+			add(o, known);
+	}
+	else if (auto inst = dynamic_cast<const instance*>(object.get())) {
+		if (!flatten(*inst, known) && push_ref(instance_type, instances.size()))
+			instances.push_back(*inst);
+	}
+	else if (auto node = dynamic_cast<const bvh_node*>(object.get())) {
+		add(node->left, known);
+		if (node->right != node->left)
+			add(node->right, known);
+	}
+	else if (auto s = dynamic_cast<const sphere*>(object.get())) {
+		if (push_ref(sphere_type, spheres.size()))
+			spheres.push_back(*s);
+	}
+	else if (auto q = dynamic_cast<const quad*>(object.get())) {
+		if (push_ref(quad_type, quads.size()))
+			quads.push_back(*q);
+	}
+	else if (auto t = dynamic_cast<const triangle*>(object.get())) {
+		if (push_ref(triangle_type, triangles.size()))
+			triangles.push_back(*t);
+	}
+	else if (auto mesh = std::dynamic_pointer_cast<triangle_mesh>(object)) {
+		//the vertex buffers stay where they are, every face just gets a reference
+		auto first = mesh_face_total;
+		if (add_mesh(mesh)) {
+			refs.reserve(refs.size() + mesh->face_count());
+			for (size_t face = 0; face < mesh->face_count(); face++)
+				refs.push_back(make_ref(mesh_face_type, first + face));
+		}
+	}
+	else {
+		if (push_ref(other_type, others.size()))
+			others.push_back(object);
+	}
+}
+
+//an instance of a handful of pieces (a box, say) costs less as world space copies of them than traced through its transform.
+//false if it's bigger than that, or if moving something would change how it looks: mirrored triangles would turn
+//their back to the camera and spheres only stay spheres under a uniform scale. quads get hit from both sides anyway
+bool primitive_store::flatten(const instance& inst, instanced_pieces& known) {
+	const size_t max_pieces = 16;
+	auto too_big = [&](const primitive_store& p) { return p.size() > max_pieces || !p.meshes.empty() || !p.others.empty(); };
+
+	auto pieces = bvh_primitives(*inst.object);
+	if (!pieces) {
+		auto it = known.find(inst.object.get());
+		if (it == known.end()) {
+			auto local = make_shared<primitive_store>();
+			local->add(inst.object, known);
+			it = known.emplace(inst.object.get(), too_big(*local) ? nullptr : local).first;
+		}
+		if (!it->second)
+			return false;
+		pieces = it->second.get();
+	}
+	if (too_big(*pieces))
+		return false;
+
+	const auto& m = inst.to_world;
+	if (!pieces->triangles.empty() && m.determinant() < 0)
+		return false;
+	float scale = m.m[0][0];
+	if (!pieces->spheres.empty()) {
+		if (scale <= 0)
+			return false;
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				if (m.m[r][c] != (r == c ? scale : 0))
+					return false;
+	}
+
+	auto material = [&](uint32_t id) { return scene_materials().get(inst.piece_material(id)); };
+	for (auto ref : pieces->refs) {
+		auto i = ref_index(ref);
+		switch (ref_type(ref)) {
+		case sphere_type: {
+			const auto& s = pieces->spheres[i];
+			if (push_ref(sphere_type, spheres.size()))
+				spheres.emplace_back(m.point(s.center), s.radius * scale, material(s.mat_id));
+			break;
+		}
+		case quad_type: {
+			const auto& q = pieces->quads[i];
+			if (push_ref(quad_type, quads.size()))
+				quads.emplace_back(m.point(q.q), m.vector(q.u), m.vector(q.v), material(q.mat_id));
+			break;
+		}
+		case triangle_type: {
+			const auto& t = pieces->triangles[i];
+			if (push_ref(triangle_type, triangles.size()))
+				triangles.emplace_back(m.point(t.vertex0), m.point(t.vertex1), m.point(t.vertex2), material(t.mat_id));
+			break;
+		}
+		default: {
+			//an instance in the instance, moved the rest of the way
+			const auto& inner = pieces->instances[i];
+			if (push_ref(instance_type, instances.size()))
+				instances.emplace_back(inner.object, m * inner.to_world, inst.piece_material(inner.material_override));
+			break;
+		}
+		}
+	}
+	return true;
+}
+
+inline bool primitive_store::hit(uint32_t ref, const ray& r, float t_min, float t_max, hit_record& rec) const {
+	//qualified calls, the compiler knows the exact type and can inline them
+	auto i = ref_index(ref);
+	switch (ref_type(ref)) {
+	case sphere_type:	return spheres[i].sphere::hit(r, t_min, t_max, rec);
+	case quad_type:		return quads[i].quad::hit(r, t_min, t_max, rec);
+	case triangle_type:	return triangles[i].triangle::hit(r, t_min, t_max, rec);
+	case mesh_face_type: {
+		auto mesh = mesh_of_face(i);
+		return meshes[mesh]->hit_face(i - mesh_first_face[mesh], r, t_min, t_max, rec);
+	}
+	case instance_type:	return instances[i].instance::hit(r, t_min, t_max, rec);
+	default:			return others[i]->hit(r, t_min, t_max, rec);
+	}
+}
+
+aabb primitive_store::bounding_box(uint32_t ref) const {
+	aabb box;
+	auto i = ref_index(ref);
+	switch (ref_type(ref)) {
+	case sphere_type:	spheres[i].bounding_box(0, 0, box); break;
+	case quad_type:		quads[i].bounding_box(0, 0, box); break;
+	case triangle_type:	triangles[i].bounding_box(0, 0, box); break;
+	case mesh_face_type: {
+		auto mesh = mesh_of_face(i);
+		box = meshes[mesh]->face_box(i - mesh_first_face[mesh]);
+		break;
+	}
+	case instance_type:	instances[i].bounding_box(0, 0, box); break;
+	default:
+		if (!others[i]->bounding_box(0, 0, box))
+			std::cerr << "No bounding box in linear_bvh constructor.\n";
+	}
+	return box;
+}
+
+//one node is exactly 32 bytes, two of them share a cache line.
+//the first child of an interior node is always the next node, only the second one needs an index
+struct alignas(32) linear_bvh_node {
+	float bmin[3];
+	uint32_t offset;	//leaf: first primitive, interior: index of the second child
+	float bmax[3];
+	uint16_t count;		//number of primitives, 0 for interior nodes
+	uint8_t axis;		//split axis, decides which child gets visited first
+	uint8_t pad;
+
+	bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+//slab test against a ray with precomputed inverse direction, no divisions and no swapping.
+//plain comparisons instead of fminf/fmaxf, those end up as library calls.
+//if an axis produces a NaN (ray parallel to and exactly on a slab) the comparisons fail and the axis is ignored
+inline bool hit_node_box(const linear_bvh_node& node, const point3& origin, const vec3& inv_dir, float t_min, float t_max) {
+	for (int a = 0; a < 3; a++) {
+		auto t0 = (node.bmin[a] - origin[a]) * inv_dir[a];
+		auto t1 = (node.bmax[a] - origin[a]) * inv_dir[a];
+		auto t_near = t0 < t1 ? t0 : t1;
+		auto t_far = t0 < t1 ? t1 : t0;
+		t_min = t_near > t_min ? t_near : t_min;
+		t_max = t_far < t_max ? t_far : t_max;
+	}
+	return t_min <= t_max;
+}
+
+//the bvh compiled into one contiguous array, nodes in depth first order.
+//traversal is a loop with a small stack, no recursion and no virtual calls except for "other" primitives
+class linear_bvh : public hittable {
+public:
+	static const int max_leaf_size = 4;
+	static const int max_depth = 64;
+
+	linear_bvh() {}
+	linear_bvh(const hittable_list& list);
+	//an already built bvh, e.g. one straight out of the scene cache
+	linear_bvh(buffer<linear_bvh_node> n, primitive_store p) : nodes(std::move(n)), prims(std::move(p)) {}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+public:
+	buffer<linear_bvh_node> nodes;
+	primitive_store prims;
+
+private:
+	uint32_t build(std::vector<bvh_primitive>& build_prims, size_t start, size_t end, int depth, std::vector<uint32_t>& ordered);
+};
+
+linear_bvh::linear_bvh(const hittable_list& list) {
+	primitive_store::instanced_pieces known;
+	for (const auto& object : list.objects)
+		prims.add(object, known);
+
+	if (prims.size() == 0)
+		return;
+
+	std::vector<bvh_primitive> build_prims;
+	build_prims.reserve(prims.size());
+	for (size_t i = 0; i < prims.size(); i++) {
+		auto box = prims.bounding_box(prims.refs[i]);
+		build_prims.push_back({ box, box.centroid(), i });
+	}
+
+	//leaves reference a contiguous range of refs, so they get reordered into leaf order while building
+	std::vector<uint32_t> ordered;
+	ordered.reserve(prims.size());
+	nodes.reserve(2 * prims.size());
+	build(build_prims, 0, build_prims.size(), 0, ordered);
+	prims.refs = std::move(ordered);
+}
+
+uint32_t linear_bvh::build(std::vector<bvh_primitive>& build_prims, size_t start, size_t end, int depth, std::vector<uint32_t>& ordered) {
+	auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	aabb box = build_prims[start].box;
+	for (size_t i = start + 1; i < end; i++)
+		box = surrounding_box(box, build_prims[i].box);
+
+	auto set_box = [&](linear_bvh_node& node) {
+		for (int a = 0; a < 3; a++) {
+			node.bmin[a] = box.min()[a];
+			node.bmax[a] = box.max()[a];
+		}
+	};
+
+	auto make_leaf = [&]() {
+		auto& node = nodes[index];
+		set_box(node);
+		node.offset = static_cast<uint32_t>(ordered.size());
+		node.count = static_cast<uint16_t>(end - start);
+		for (size_t i = start; i < end; i++)
+			ordered.push_back(prims.refs[build_prims[i].index]);
+		return index;
+	};
+
+	size_t count = end - start;
+	if (count == 1)
+		return make_leaf();
+
+	auto bounds = centroid_bounds(build_prims, start, end);
+	auto split = find_sah_split(build_prims, start, end, bounds);
+
+	//splitting costs one more box test, keeping a leaf costs one intersection per primitive
+	auto split_cost = 0.125f + split.cost / box.surface_area();
+	if ((count <= max_leaf_size && split_cost >= count) || (depth >= max_depth - 2 && count <= UINT16_MAX))
+		return make_leaf();
+
+	auto mid = partition_primitives(build_prims, start, end, bounds, split);
+
+	build(build_prims, start, mid, depth + 1, ordered);
+	auto second = build(build_prims, mid, end, depth + 1, ordered);
+
+	auto& node = nodes[index];
+	set_box(node);
+	node.offset = second;
+	node.count = 0;
+	if (split.axis >= 0) {
+		node.axis = static_cast<uint8_t>(split.axis);
+	}
+	else {
+		auto extent = bounds.max() - bounds.min();
+		node.axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+	}
+	return index;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	if (nodes.empty())
+		return false;
+
+	auto origin = r.origin();
+	auto dir = r.direction();
+	vec3 inv_dir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+	bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+	uint32_t stack[max_depth];
+	int stack_size = 0;
+	uint32_t current = 0;
+	bool hit_anything = false;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (hit_node_box(node, origin, inv_dir, t_min, t_max)) {
+			if (node.is_leaf()) {
+				for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+					if (prims.hit(prims.refs[i], r, t_min, t_max, rec)) {
+						hit_anything = true;
+						t_max = rec.t;
+					}
+				}
+				if (stack_size == 0) break;
+				current = stack[--stack_size];
+			}
+			else {
+				//visit the child closer to the ray origin first so t_max shrinks early
+				if (dir_is_neg[node.axis]) {
+					stack[stack_size++] = current + 1;
+					current = node.offset;
+				}
+				else {
+					stack[stack_size++] = node.offset;
+					current = current + 1;
+				}
+			}
+		}
+		else {
+			if (stack_size == 0) break;
+			current = stack[--stack_size];
+		}
+	}
+
+	return hit_anything;
+}
+
+bool linear_bvh::bounding_box(float time0, float time1, aabb& output_box) const {
+	if (nodes.empty())
+		return false;
+
+	output_box = aabb(point3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]),
+		point3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+	return true;
+}
+
+#endif // !LINEAR_BVH_H
@@ -0,0 +1,60 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+mapped_file::mapped_file(const char* filename) {
+	HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return;
+	file = f;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(f, &file_size) || file_size.QuadPart == 0)
+		return;
+
+	mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+		return;
+
+	bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (bytes)
+		length = static_cast<size_t>(file_size.QuadPart);
+}
+
+mapped_file::~mapped_file() {
+	if (bytes) UnmapViewOfFile(bytes);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::mapped_file(const char* filename) {
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+		return;
+
+	void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+		return;
+
+	bytes = static_cast<const char*>(view);
+	length = static_cast<size_t>(st.st_size);
+	madvise(view, length, MADV_SEQUENTIAL);
+}
+
+mapped_file::~mapped_file() {
+	if (bytes) munmap(const_cast<char*>(bytes), length);
+	if (fd >= 0) close(fd);
+}
+#endif
@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+//a whole file mapped into memory read only, the os pages it in as it gets read.
+//the os specific part lives in mapped_file.cpp, windows.h doesn't get along with the WinMain in Source.cpp
+class mapped_file {
+public:
+	mapped_file(const char* filename);
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool is_open() const { return bytes != nullptr; }
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const char* bytes = nullptr;
+	size_t length = 0;
+
+	//file and mapping handles on windows, the file descriptor everywhere else
+	void* file = nullptr;
+	void* mapping = nullptr;
+	int fd = -1;
+};
+
+#endif // !MAPPED_FILE_H
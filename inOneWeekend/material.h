@@ -4,6 +4,7 @@
 #include "common.h"
 #include "ray.h"
 #include "hittable.h"
+#include "onb.h"
 #include "texture.h"
 
 struct hit_record;
@@ -17,8 +18,46 @@ public:
 	virtual bool emitted(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, color& emit) const {
 		return false;
 	}
+
+	//whether anything with this material can emit light, those primitives end up in the light_list
+	virtual bool is_emissive() const {
+		return false;
+	}
+
+	//perfect mirrors and glass only reflect one exact direction, light sampling can never find it.
+	//everything else samples the lights and gets eval and pdf called
+	virtual bool is_specular(const hit_record& rec) const {
+		return true;
+	}
+
+	//brdf times cosine for light coming in from direction (unit length, pointing away from the surface)
+	virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+		return color(0, 0, 0);
+	}
+
+	//probability density of scatter picking direction, per unit solid angle
+	virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+		return 0;
+	}
 };
 
+//f = albedo / pi, shared by everything that reflects like lambertian
+inline color lambert_eval(const color& albedo, const hit_record& rec, const vec3& direction) {
+	auto cosine = dot(rec.normal, direction);
+	return cosine > 0 ? albedo * (cosine / pi) : color(0, 0, 0);
+}
+
+inline float lambert_pdf(const hit_record& rec, const vec3& direction) {
+	auto cosine = dot(rec.normal, direction);
+	return cosine > 0 ? cosine / pi : 0;
+}
+
+//cosine weighted sample, the pdf cancels the cosine in the brdf so the weight f * cos / pdf is just the albedo
+inline void lambert_scatter(const color& albedo, const hit_record& rec, color& attenuation, ray& scattered) {
+	scattered = ray(rec.p, onb(rec.normal).local(random_cosine_direction()));
+	attenuation = albedo;
+}
+
 class diffuse_light : public material {
 public:
 	diffuse_light(shared_ptr<texture> a) : albedo(a), emit_map(make_shared<solid_color>(1)) {}
@@ -26,27 +65,44 @@ public:
 	diffuse_light(shared_ptr<texture> a, shared_ptr<texture> f) : albedo(a), emit_map(f) {}
 	diffuse_light(const color& a, shared_ptr<texture> f) : albedo(make_shared<solid_color>(a)), emit_map(f) {}
 
+	//the parts that don't glow are plain diffuse
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
-		auto scatter_direction = random_in_hemisphere(rec.normal);
-
-		if (scatter_direction.near_zero())
-			scatter_direction = rec.normal;
-
-		scattered = ray(rec.p, scatter_direction);
-		attenuation = albedo->value(rec.u, rec.v, rec.p);
+		lambert_scatter(albedo->value(rec.u, rec.v, rec.p), rec, attenuation, scattered);
 		return true;
 	}
 
 	virtual bool emitted(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, color& emit) const override {
-		if (emit_map->value(rec.u, rec.v, rec.normal).x() == 1) {
+		if (glows(rec)) {
 			emit = albedo->value(rec.u, rec.v, rec.p);
 			return true;
 		}
 		emit = color(0, 0, 0);
 		return false;
 	}
+
+	virtual bool is_emissive() const override {
+		return true;
+	}
+
+	virtual bool is_specular(const hit_record& rec) const override {
+		return false;
+	}
+
+	virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return lambert_eval(albedo->value(rec.u, rec.v, rec.p), rec, direction);
+	}
+
+	virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return lambert_pdf(rec, direction);
+	}
+
+	//only where the emit map is exactly white
+	bool glows(const hit_record& rec) const {
+		return emit_map->value(rec.u, rec.v, rec.normal).x() == 1;
+	}
+
 public:
 	shared_ptr<texture> albedo;
 	shared_ptr<texture> emit_map;
@@ -60,20 +116,66 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
-		auto scatter_direction = random_in_hemisphere(rec.normal);
+		lambert_scatter(albedo->value(rec.u, rec.v, rec.p), rec, attenuation, scattered);
+		return true;
+	}
 
-		if (scatter_direction.near_zero())
-			scatter_direction = rec.normal;
+	virtual bool is_specular(const hit_record& rec) const override {
+		return false;
+	}
 
-		scattered = ray(rec.p, scatter_direction);
-		attenuation = albedo->value(rec.u, rec.v, rec.p);
-		return true;
+	virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return lambert_eval(albedo->value(rec.u, rec.v, rec.p), rec, direction);
+	}
+
+	virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return lambert_pdf(rec, direction);
 	}
 
 public:
 	shared_ptr<texture> albedo;
 };
 
+//metal: fuzz picks how wide the reflection is, 0 (the exponent is 0 too) is a perfect mirror.
+//the rough ones use a phong lobe around the mirror direction so eval and pdf have a closed form,
+//the exponent is chosen so the spread is about the same as the old random_in_unit_sphere nudge
+inline float metal_exponent(float fuzz) {
+	if (fuzz < 0.001f)
+		return 0;
+	fuzz = std::min(fuzz, 1.0f);
+	return 2 / (fuzz * fuzz);
+}
+
+inline bool metal_scatter(const color& albedo, float exponent, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+	vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+	if (exponent > 0) {
+		float r1, r2;
+		random_float2(r1, r2);
+		auto cosine = std::pow(r1, 1 / (exponent + 1));
+		auto sine = sqrt(std::max(0.0f, 1 - cosine * cosine));
+		auto phi = 2 * pi * r2;
+		reflected = onb(reflected).local(cos(phi) * sine, sin(phi) * sine, cosine);
+	}
+	scattered = ray(rec.p, reflected);
+
+	//sampled proportional to the lobe, so the weight f * cos / pdf is just the albedo
+	attenuation = albedo;
+	return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+inline float metal_pdf(float exponent, const ray& r_in, const hit_record& rec, const vec3& direction) {
+	auto cosine = dot(reflect(unit_vector(r_in.direction()), rec.normal), direction);
+	if (exponent == 0 || cosine <= 0)
+		return 0;
+	return (exponent + 1) / (2 * pi) * std::pow(cosine, exponent);
+}
+
+inline color metal_eval(const color& albedo, float exponent, const ray& r_in, const hit_record& rec, const vec3& direction) {
+	if (dot(direction, rec.normal) <= 0)
+		return color(0, 0, 0);
+	return albedo * metal_pdf(exponent, r_in, rec, direction);
+}
+
 class metal : public material {
 public:
 	metal(const color& a, float f) : albedo(make_shared<solid_color>(a)), fuzz(make_shared<solid_color>(f < 1 ? f : 1)) {}
@@ -84,10 +186,23 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
-		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflected + fuzz->value(rec.u, rec.v, rec.normal).x() * random_in_unit_sphere());
-		attenuation = albedo->value(rec.u, rec.v, rec.p);
-		return (dot(scattered.direction(), rec.normal) > 0);
+		return metal_scatter(albedo->value(rec.u, rec.v, rec.p), lobe_exponent(rec), r_in, rec, attenuation, scattered);
+	}
+
+	virtual bool is_specular(const hit_record& rec) const override {
+		return lobe_exponent(rec) == 0;
+	}
+
+	virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return metal_eval(albedo->value(rec.u, rec.v, rec.p), lobe_exponent(rec), r_in, rec, direction);
+	}
+
+	virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+		return metal_pdf(lobe_exponent(rec), r_in, rec, direction);
+	}
+
+	float lobe_exponent(const hit_record& rec) const {
+		return metal_exponent(fuzz->value(rec.u, rec.v, rec.normal).x());
 	}
 
 public:
@@ -95,6 +210,35 @@ public:
 	shared_ptr<texture> albedo;
 };
 
+//Schlicks approximation for reflectance, the 5th power multiplied out instead of a double pow
+inline float schlick_reflectance(float cosine, float ref_idx) {
+	auto r0 = (1 - ref_idx) / (1 + ref_idx);
+	r0 = r0 * r0;
+	auto x = 1 - cosine;
+	auto x2 = x * x;
+	return r0 + (1 - r0) * x2 * x2 * x;
+}
+
+inline bool dielectric_scatter(float ir, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+	attenuation = color(1.0, 1.0, 1.0);
+	float refractionRatio = rec.front_face ? (1.0f / ir) : ir;
+
+	vec3 unitDirection = unit_vector(r_in.direction());
+	float cosTheta = std::min(dot(-unitDirection, rec.normal), 1.0f);
+	float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
+
+	bool cannotRefract = refractionRatio * sinTheta > 1.0f;
+	vec3 direction;
+
+	if (cannotRefract || schlick_reflectance(cosTheta, refractionRatio) > random_float())
+		direction = reflect(unitDirection, rec.normal);
+	else
+		direction = refract(unitDirection, rec.normal, refractionRatio);
+
+	scattered = ray(rec.p, direction);
+	return true;
+}
+
 //Tip for hollow glass spheres: in a sphere add another sphere with a negative radius
 class dielectric : public material {
 public:
@@ -103,34 +247,11 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
-		attenuation = color(1.0, 1.0, 1.0);
-		double refractionRatio = rec.front_face ? (1.0 / ir) : ir;
-
-		vec3 unitDirection = unit_vector(r_in.direction());
-		float cosTheta = fmin(dot(-unitDirection, rec.normal), 1.0);
-		float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
-
-		bool cannotRefract = refractionRatio * sinTheta > 1.0;
-		vec3 direction;
-
-		if (cannotRefract || reflectance(cosTheta, refractionRatio) > random_float())
-			direction = reflect(unitDirection, rec.normal);
-		else
-			direction = refract(unitDirection, rec.normal, refractionRatio);
-
-		scattered = ray(rec.p, direction);
-		return true;
+		return dielectric_scatter(ir, r_in, rec, attenuation, scattered);
 	}
 
 public:
 	float ir;
-private:
-	static double reflectance(float cosine, float ref_idx) {
-		//Schlicks approximation for reflectance
-		auto r0 = (1 - ref_idx) / (1 + ref_idx);
-		r0 = r0 * r0;
-		return r0 + (1 - r0) * pow((1 - cosine), 5);
-	}
 };
 
 #endif // !MATERIAL_H
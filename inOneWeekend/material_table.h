@@ -0,0 +1,253 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "material.h"
+#include "texture.h"
+
+using std::shared_ptr;
+
+//scenes are still built from the material and texture classes, the table flattens the built in ones into the records below.
+//a bounce then costs a switch on the record and a few array lookups instead of a virtual call through a shared_ptr
+//for the material and one more for every texture it reads.
+//material or texture classes the table doesn't know about still work, they're called through their virtual functions
+
+enum class texture_kind : uint8_t { solid, checker, image, other };
+
+struct texture_data {
+	texture_kind kind;
+	uint32_t even, odd;				//checker, ids of the two textures
+	color value;					//solid
+	const unsigned char* texels;	//image, nullptr if it didn't load
+	int width, height, bytes_per_scanline, bytes_per_pixel;
+	const texture* other;
+};
+
+enum class material_kind : uint8_t { lambertian, metal, dielectric, diffuse_light, other };
+
+struct material_data {
+	material_kind kind;
+	uint32_t albedo;		//texture id
+	uint32_t second;		//texture id of the fuzz for metal, of the emit map for diffuse_light
+	float ir;				//dielectric
+	const material* other;
+
+	//same meaning as the functions of the same name in material
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const;
+	bool emitted(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, color& emit) const;
+	bool is_emissive() const;
+	bool is_specular(const hit_record& rec) const;
+	color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const;
+	float pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const;
+};
+
+//every material in the scene lives here, primitives and hit records only carry its index.
+//copying an index around is free, copying a shared_ptr means an atomic refcount every time a closer hit is found
+class material_table {
+public:
+	//the same material always gets the same id
+	uint32_t add(const shared_ptr<material>& m);
+
+	const material_data& operator[](uint32_t id) const { return records[id]; }
+	const shared_ptr<material>& get(uint32_t id) const { return materials[id]; }
+	size_t size() const { return materials.size(); }
+
+	color texture_value(uint32_t id, float u, float v, const point3& p) const;
+
+private:
+	uint32_t add_texture(const shared_ptr<texture>& t);
+
+	//the shared_ptrs keep everything the records point to alive
+	std::vector<shared_ptr<material>> materials;
+	std::vector<material_data> records;
+	std::unordered_map<const material*, uint32_t> ids;
+
+	std::vector<shared_ptr<texture>> texture_objects;
+	std::vector<texture_data> textures;
+	std::unordered_map<const texture*, uint32_t> texture_ids;
+};
+
+//materials are added while the scene is built and only read while it renders
+inline material_table& scene_materials() {
+	static material_table table;
+	return table;
+}
+
+inline uint32_t material_table::add(const shared_ptr<material>& m) {
+	auto it = ids.find(m.get());
+	if (it != ids.end())
+		return it->second;
+
+	material_data r = {};
+	r.kind = material_kind::other;
+	r.other = m.get();
+	if (auto l = dynamic_cast<const lambertian*>(m.get())) {
+		r.kind = material_kind::lambertian;
+		r.albedo = add_texture(l->albedo);
+	}
+	else if (auto met = dynamic_cast<const metal*>(m.get())) {
+		r.kind = material_kind::metal;
+		r.albedo = add_texture(met->albedo);
+		r.second = add_texture(met->fuzz);
+	}
+	else if (auto d = dynamic_cast<const dielectric*>(m.get())) {
+		r.kind = material_kind::dielectric;
+		r.ir = d->ir;
+	}
+	else if (auto light = dynamic_cast<const diffuse_light*>(m.get())) {
+		r.kind = material_kind::diffuse_light;
+		r.albedo = add_texture(light->albedo);
+		r.second = add_texture(light->emit_map);
+	}
+
+	materials.push_back(m);
+	records.push_back(r);
+	return ids[m.get()] = static_cast<uint32_t>(materials.size() - 1);
+}
+
+inline uint32_t material_table::add_texture(const shared_ptr<texture>& t) {
+	auto it = texture_ids.find(t.get());
+	if (it != texture_ids.end())
+		return it->second;
+
+	texture_data r = {};
+	r.kind = texture_kind::other;
+	r.other = t.get();
+	if (auto solid = dynamic_cast<const solid_color*>(t.get())) {
+		r.kind = texture_kind::solid;
+		r.value = solid->color_value;
+	}
+	else if (auto checker = dynamic_cast<const checker_texture*>(t.get())) {
+		r.kind = texture_kind::checker;
+		r.even = add_texture(checker->even);
+		r.odd = add_texture(checker->odd);
+	}
+	else if (auto image = dynamic_cast<const image_texture*>(t.get())) {
+		r.kind = texture_kind::image;
+		r.texels = image->data;
+		r.width = image->width;
+		r.height = image->height;
+		r.bytes_per_scanline = image->bytes_per_scanline;
+		r.bytes_per_pixel = image_texture::bytes_per_pixel;
+	}
+	else if (auto grey = dynamic_cast<const greyscale*>(t.get())) {
+		r.kind = texture_kind::image;
+		r.texels = grey->data;
+		r.width = grey->width;
+		r.height = grey->height;
+		r.bytes_per_scanline = grey->bytes_per_scanline;
+		r.bytes_per_pixel = greyscale::bytes_per_pixel;
+	}
+
+	texture_objects.push_back(t);
+	textures.push_back(r);
+	return texture_ids[t.get()] = static_cast<uint32_t>(textures.size() - 1);
+}
+
+inline color material_table::texture_value(uint32_t id, float u, float v, const point3& p) const {
+	//checkers just pick one of their two textures, no recursion needed
+	while (true) {
+		const auto& t = textures[id];
+		switch (t.kind) {
+		case texture_kind::solid:
+			return t.value;
+		case texture_kind::checker:
+			id = checker_texture::is_odd(p) ? t.odd : t.even;
+			break;
+		case texture_kind::image:
+			return texel_color(t.texels, t.width, t.height, t.bytes_per_scanline, t.bytes_per_pixel, u, v);
+		default:
+			return t.other->value(u, v, p);
+		}
+	}
+}
+
+inline bool material_data::scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+	const auto& table = scene_materials();
+	switch (kind) {
+	case material_kind::lambertian:
+	case material_kind::diffuse_light:
+		lambert_scatter(table.texture_value(albedo, rec.u, rec.v, rec.p), rec, attenuation, scattered);
+		return true;
+	case material_kind::metal:
+		return metal_scatter(table.texture_value(albedo, rec.u, rec.v, rec.p), metal_exponent(table.texture_value(second, rec.u, rec.v, rec.normal).x()),
+			r_in, rec, attenuation, scattered);
+	case material_kind::dielectric:
+		return dielectric_scatter(ir, r_in, rec, attenuation, scattered);
+	default:
+		return other->scatter(r_in, rec, attenuation, scattered);
+	}
+}
+
+inline bool material_data::emitted(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, color& emit) const {
+	switch (kind) {
+	case material_kind::diffuse_light: {
+		const auto& table = scene_materials();
+		//only where the emit map is exactly white
+		if (table.texture_value(second, rec.u, rec.v, rec.normal).x() == 1) {
+			emit = table.texture_value(albedo, rec.u, rec.v, rec.p);
+			return true;
+		}
+		emit = color(0, 0, 0);
+		return false;
+	}
+	case material_kind::other:
+		return other->emitted(r_in, rec, attenuation, scattered, emit);
+	default:
+		return false;
+	}
+}
+
+inline bool material_data::is_emissive() const {
+	return kind == material_kind::diffuse_light || (kind == material_kind::other && other->is_emissive());
+}
+
+inline bool material_data::is_specular(const hit_record& rec) const {
+	switch (kind) {
+	case material_kind::lambertian:
+	case material_kind::diffuse_light:
+		return false;
+	case material_kind::metal:
+		return metal_exponent(scene_materials().texture_value(second, rec.u, rec.v, rec.normal).x()) == 0;
+	case material_kind::dielectric:
+		return true;
+	default:
+		return other->is_specular(rec);
+	}
+}
+
+inline color material_data::eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+	const auto& table = scene_materials();
+	switch (kind) {
+	case material_kind::lambertian:
+	case material_kind::diffuse_light:
+		return lambert_eval(table.texture_value(albedo, rec.u, rec.v, rec.p), rec, direction);
+	case material_kind::metal:
+		return metal_eval(table.texture_value(albedo, rec.u, rec.v, rec.p), metal_exponent(table.texture_value(second, rec.u, rec.v, rec.normal).x()),
+			r_in, rec, direction);
+	case material_kind::dielectric:
+		return color(0, 0, 0);
+	default:
+		return other->eval(r_in, rec, direction);
+	}
+}
+
+inline float material_data::pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+	switch (kind) {
+	case material_kind::lambertian:
+	case material_kind::diffuse_light:
+		return lambert_pdf(rec, direction);
+	case material_kind::metal:
+		return metal_pdf(metal_exponent(scene_materials().texture_value(second, rec.u, rec.v, rec.normal).x()), r_in, rec, direction);
+	case material_kind::dielectric:
+		return 0;
+	default:
+		return other->pdf(r_in, rec, direction);
+	}
+}
+
+#endif // !MATERIAL_TABLE_H
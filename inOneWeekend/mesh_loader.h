@@ -0,0 +1,643 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+//runs fn(chunk) for every chunk on its own thread and waits for all of them
+template <typename F>
+void parallel_chunks(size_t chunks, F fn) {
+	std::vector<std::future<void>> ftr;
+	for (size_t c = 0; c < chunks; c++)
+		ftr.push_back(std::async(std::launch::async, fn, c));
+	for (auto& f : ftr)
+		f.get();
+}
+
+inline size_t loader_thread_count() {
+	return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+//------------------------------------------------------------------------------------------------
+// OBJ
+//
+// the file gets cut into one chunk per thread at line breaks and parsed twice:
+// the first pass only counts vertices and triangles per chunk, which gives every chunk its
+// write offset into the final buffers, the second pass parses straight into them.
+// polygons are triangulated as fans, materials (usemtl) are ignored, the whole mesh gets one.
+// normals and uvs are only kept if every face uses the same index for them as for the position,
+// the mesh has one index per corner so it can't represent anything else
+//------------------------------------------------------------------------------------------------
+
+namespace obj_detail {
+	struct chunk {
+		const char* begin;
+		const char* end;
+		size_t positions = 0, uvs = 0, normals = 0, triangles = 0;
+		size_t position_offset = 0, uv_offset = 0, normal_offset = 0, triangle_offset = 0;
+		bool uvs_match = true, normals_match = true, valid = true;
+	};
+
+	inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	inline const char* skip_space(const char* p, const char* end) {
+		while (p < end && is_space(*p)) p++;
+		return p;
+	}
+
+	inline const char* line_end(const char* p, const char* end) {
+		auto nl = static_cast<const char*>(memchr(p, '\n', end - p));
+		return nl ? nl : end;
+	}
+
+	inline const char* parse_float(const char* p, const char* end, float& out) {
+		p = skip_space(p, end);
+		if (p < end && *p == '+') p++;
+		auto result = std::from_chars(p, end, out);
+		if (result.ec != std::errc()) out = 0;
+		return result.ptr;
+	}
+
+	//obj indices start at 1, negative ones count back from the last vertex read so far
+	inline const char* parse_index(const char* p, const char* end, long long& out, bool& present) {
+		bool negative = false;
+		if (p < end && *p == '-') { negative = true; p++; }
+		present = p < end && *p >= '0' && *p <= '9';
+		long long v = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			v = v * 10 + (*p++ - '0');
+		out = negative ? -v : v;
+		return p;
+	}
+
+	inline long long resolve(long long index, size_t seen) {
+		return index > 0 ? index - 1 : static_cast<long long>(seen) + index;
+	}
+
+	//the keyword at the start of a line, v, vt, vn and f are the only ones that matter
+	enum class line_type { other, position, uv, normal, face };
+
+	inline line_type classify(const char*& p, const char* end) {
+		p = skip_space(p, end);
+		if (end - p < 2) return line_type::other;
+		if (p[0] == 'v') {
+			if (is_space(p[1])) { p += 2; return line_type::position; }
+			if (p[1] == 't' && end - p > 2 && is_space(p[2])) { p += 3; return line_type::uv; }
+			if (p[1] == 'n' && end - p > 2 && is_space(p[2])) { p += 3; return line_type::normal; }
+		}
+		else if (p[0] == 'f' && is_space(p[1])) {
+			p += 2;
+			return line_type::face;
+		}
+		return line_type::other;
+	}
+
+	inline size_t count_corners(const char* p, const char* end) {
+		size_t corners = 0;
+		while (true) {
+			p = skip_space(p, end);
+			if (p >= end) break;
+			corners++;
+			while (p < end && !is_space(*p)) p++;
+		}
+		return corners;
+	}
+
+	void count(chunk& c) {
+		for (auto p = c.begin; p < c.end;) {
+			auto eol = line_end(p, c.end);
+			switch (classify(p, eol)) {
+			case line_type::position:	c.positions++; break;
+			case line_type::uv:			c.uvs++; break;
+			case line_type::normal:		c.normals++; break;
+			case line_type::face: {
+				auto corners = count_corners(p, eol);
+				if (corners >= 3) c.triangles += corners - 2;
+				break;
+			}
+			default: break;
+			}
+			p = eol + 1;
+		}
+	}
+
+	void parse(chunk& c, triangle_mesh& mesh, std::vector<float>& uvs, std::vector<vec3>& normals) {
+		size_t positions = c.position_offset, uv_count = c.uv_offset, normal_count = c.normal_offset;
+		size_t triangle = c.triangle_offset;
+		auto total_positions = mesh.positions.size();
+
+		//corners of the current polygon, reused for every face so there's no allocation per face
+		std::vector<uint32_t> corners;
+
+		for (auto p = c.begin; p < c.end;) {
+			auto eol = line_end(p, c.end);
+			switch (classify(p, eol)) {
+			case line_type::position: {
+				float x, y, z;
+				p = parse_float(p, eol, x);
+				p = parse_float(p, eol, y);
+				p = parse_float(p, eol, z);
+				mesh.positions[positions++] = point3(x, y, z);
+				break;
+			}
+			case line_type::uv: {
+				float u, v = 0;
+				p = parse_float(p, eol, u);
+				if (skip_space(p, eol) < eol) p = parse_float(p, eol, v);
+				uvs[2 * uv_count] = u;
+				uvs[2 * uv_count + 1] = v;
+				uv_count++;
+				break;
+			}
+			case line_type::normal: {
+				float x, y, z;
+				p = parse_float(p, eol, x);
+				p = parse_float(p, eol, y);
+				p = parse_float(p, eol, z);
+				normals[normal_count++] = vec3(x, y, z);
+				break;
+			}
+			case line_type::face: {
+				corners.clear();
+				while (true) {
+					p = skip_space(p, eol);
+					if (p >= eol) break;
+
+					long long v, vt = 0, vn = 0;
+					bool has_v, has_vt = false, has_vn = false;
+					p = parse_index(p, eol, v, has_v);
+					if (p < eol && *p == '/') {
+						p = parse_index(p + 1, eol, vt, has_vt);
+						if (p < eol && *p == '/')
+							p = parse_index(p + 1, eol, vn, has_vn);
+					}
+					while (p < eol && !is_space(*p)) p++;
+
+					auto index = resolve(v, positions);
+					if (!has_v || index < 0 || index >= static_cast<long long>(total_positions)) {
+						c.valid = false;
+						index = 0;
+					}
+					if (!has_vt || resolve(vt, uv_count) != index) c.uvs_match = false;
+					if (!has_vn || resolve(vn, normal_count) != index) c.normals_match = false;
+					corners.push_back(static_cast<uint32_t>(index));
+				}
+
+				for (size_t i = 1; i + 1 < corners.size(); i++) {
+					mesh.indices[3 * triangle] = corners[0];
+					mesh.indices[3 * triangle + 1] = corners[i];
+					mesh.indices[3 * triangle + 2] = corners[i + 1];
+					triangle++;
+				}
+				break;
+			}
+			default: break;
+			}
+			p = eol + 1;
+		}
+	}
+}
+
+shared_ptr<triangle_mesh> load_obj(const char* filename, shared_ptr<material> m) {
+	using namespace obj_detail;
+
+	auto mesh = make_shared<triangle_mesh>();
+	mesh->material_ids.push_back(scene_materials().add(m));
+	mesh->source = filename;
+
+	mapped_file file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Could not load mesh file '" << filename << "'.\n";
+		return mesh;
+	}
+
+	//chunk borders moved forward to the next line break, so no line gets split
+	auto data = file.data();
+	auto size = file.size();
+	auto chunk_count = std::min(loader_thread_count(), std::max<size_t>(size / (1 << 16), 1));
+	std::vector<chunk> chunks(chunk_count);
+	for (size_t c = 0; c < chunk_count; c++) {
+		size_t start = size * c / chunk_count;
+		if (c > 0) {
+			auto nl = static_cast<const char*>(memchr(data + start, '\n', size - start));
+			start = nl ? nl - data + 1 : size;
+		}
+		chunks[c].begin = data + start;
+		if (c > 0)
+			chunks[c - 1].end = chunks[c].begin;
+	}
+	chunks.back().end = data + size;
+
+	parallel_chunks(chunk_count, [&](size_t c) { count(chunks[c]); });
+
+	size_t positions = 0, uv_count = 0, normal_count = 0, triangles = 0;
+	for (auto& c : chunks) {
+		c.position_offset = positions;
+		c.uv_offset = uv_count;
+		c.normal_offset = normal_count;
+		c.triangle_offset = triangles;
+		positions += c.positions;
+		uv_count += c.uvs;
+		normal_count += c.normals;
+		triangles += c.triangles;
+	}
+
+	//everything gets allocated exactly once, the threads only fill in their part
+	mesh->positions.resize(positions);
+	mesh->indices.resize(3 * triangles);
+	std::vector<float> uvs(2 * uv_count);
+	std::vector<vec3> normals(normal_count);
+
+	parallel_chunks(chunk_count, [&](size_t c) { parse(chunks[c], *mesh, uvs, normals); });
+
+	bool uvs_match = uv_count == positions, normals_match = normal_count == positions;
+	for (const auto& c : chunks) {
+		if (!c.valid) {
+			std::cerr << "Mesh file '" << filename << "' has faces with invalid vertex indices.\n";
+			mesh->indices.clear();
+			return mesh;
+		}
+		uvs_match = uvs_match && c.uvs_match;
+		normals_match = normals_match && c.normals_match;
+	}
+	if (uvs_match) mesh->uvs = std::move(uvs);
+	if (normals_match) mesh->normals = std::move(normals);
+
+	return mesh;
+}
+
+//------------------------------------------------------------------------------------------------
+// PLY (binary only)
+//
+// vertices have a fixed size, so every thread converts its own range of them.
+// if every face is a triangle and nothing comes after the faces, they have a fixed size too
+// and get split up the same way, otherwise they're read in one go and triangulated as fans
+//------------------------------------------------------------------------------------------------
+
+namespace ply_detail {
+	enum class scalar { none, int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+
+	inline scalar parse_scalar(const std::string& name) {
+		if (name == "char" || name == "int8") return scalar::int8;
+		if (name == "uchar" || name == "uint8") return scalar::uint8;
+		if (name == "short" || name == "int16") return scalar::int16;
+		if (name == "ushort" || name == "uint16") return scalar::uint16;
+		if (name == "int" || name == "int32") return scalar::int32;
+		if (name == "uint" || name == "uint32") return scalar::uint32;
+		if (name == "float" || name == "float32") return scalar::float32;
+		if (name == "double" || name == "float64") return scalar::float64;
+		return scalar::none;
+	}
+
+	inline size_t scalar_size(scalar s) {
+		switch (s) {
+		case scalar::int8: case scalar::uint8: return 1;
+		case scalar::int16: case scalar::uint16: return 2;
+		case scalar::int32: case scalar::uint32: case scalar::float32: return 4;
+		case scalar::float64: return 8;
+		default: return 0;
+		}
+	}
+
+	//reads one value of any ply type, byte swapped if the file is big endian
+	inline double read_scalar(const char* p, scalar s, bool swap) {
+		unsigned char b[8];
+		auto n = scalar_size(s);
+		memcpy(b, p, n);
+		if (swap) std::reverse(b, b + n);
+
+		switch (s) {
+		case scalar::int8:		{ int8_t v; memcpy(&v, b, 1); return v; }
+		case scalar::uint8:		{ uint8_t v; memcpy(&v, b, 1); return v; }
+		case scalar::int16:		{ int16_t v; memcpy(&v, b, 2); return v; }
+		case scalar::uint16:	{ uint16_t v; memcpy(&v, b, 2); return v; }
+		case scalar::int32:		{ int32_t v; memcpy(&v, b, 4); return v; }
+		case scalar::uint32:	{ uint32_t v; memcpy(&v, b, 4); return v; }
+		case scalar::float32:	{ float v; memcpy(&v, b, 4); return v; }
+		case scalar::float64:	{ double v; memcpy(&v, b, 8); return v; }
+		default: return 0;
+		}
+	}
+
+	struct property {
+		std::string name;
+		scalar type = scalar::none;
+		scalar count_type = scalar::none;	//only set for lists
+		size_t offset = 0;					//byte offset in the element, only valid before the first list
+	};
+
+	struct element {
+		std::string name;
+		size_t count = 0;
+		std::vector<property> properties;
+		size_t stride = 0;					//0 if the element contains a list and has no fixed size
+
+		int find(const char* n) const {
+			for (size_t i = 0; i < properties.size(); i++)
+				if (properties[i].name == n) return static_cast<int>(i);
+			return -1;
+		}
+	};
+
+	//size of one element starting at p, lists included. false if it doesn't fit in front of end,
+	//nothing gets read past end on the way
+	inline bool element_size(const element& e, const char* p, const char* end, bool swap, size_t& size) {
+		size_t left = static_cast<size_t>(end - p);
+		size = 0;
+		for (const auto& prop : e.properties) {
+			if (prop.count_type != scalar::none) {
+				auto count_size = scalar_size(prop.count_type);
+				if (count_size > left - size)
+					return false;
+				auto count = static_cast<size_t>(read_scalar(p + size, prop.count_type, swap));
+				size += count_size;
+				if (count > (left - size) / scalar_size(prop.type))
+					return false;
+				size += count * scalar_size(prop.type);
+			}
+			else {
+				if (scalar_size(prop.type) > left - size)
+					return false;
+				size += scalar_size(prop.type);
+			}
+		}
+		return true;
+	}
+}
+
+shared_ptr<triangle_mesh> load_ply(const char* filename, shared_ptr<material> m) {
+	using namespace ply_detail;
+
+	auto mesh = make_shared<triangle_mesh>();
+	mesh->material_ids.push_back(scene_materials().add(m));
+	mesh->source = filename;
+
+	mapped_file file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Could not load mesh file '" << filename << "'.\n";
+		return mesh;
+	}
+
+	auto data = file.data();
+	auto size = file.size();
+	auto fail = [&](const char* reason) {
+		std::cerr << "Could not load mesh file '" << filename << "': " << reason << "\n";
+		mesh->positions.clear();
+		mesh->indices.clear();
+		return mesh;
+	};
+
+	//the header is plain text and ends with "end_header"
+	std::vector<element> elements;
+	bool swap = false, binary = false;
+	size_t p = 0;
+	while (true) {
+		auto nl = static_cast<const char*>(memchr(data + p, '\n', size - p));
+		if (!nl)
+			return fail("no end_header");
+
+		std::string line(data + p, nl);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		p = nl - data + 1;
+
+		std::vector<std::string> words;
+		for (size_t i = 0; i < line.size();) {
+			auto j = line.find(' ', i);
+			if (j == std::string::npos) j = line.size();
+			if (j > i) words.push_back(line.substr(i, j - i));
+			i = j + 1;
+		}
+		if (words.empty())
+			continue;
+
+		if (words[0] == "end_header") {
+			break;
+		}
+		else if (words[0] == "format" && words.size() > 1) {
+			binary = words[1] != "ascii";
+			swap = words[1] == "binary_big_endian";
+		}
+		else if (words[0] == "element" && words.size() > 2) {
+			element e;
+			e.name = words[1];
+			const auto& count = words[2];
+			auto result = std::from_chars(count.data(), count.data() + count.size(), e.count);
+			if (result.ec != std::errc() || result.ptr != count.data() + count.size())
+				return fail("bad element count");
+			elements.push_back(e);
+		}
+		else if (words[0] == "property" && !elements.empty()) {
+			property prop;
+			if (words.size() > 4 && words[1] == "list") {
+				prop.count_type = parse_scalar(words[2]);
+				prop.type = parse_scalar(words[3]);
+				prop.name = words[4];
+			}
+			else if (words.size() > 2) {
+				prop.type = parse_scalar(words[1]);
+				prop.name = words[2];
+			}
+			if (prop.type == scalar::none)
+				return fail("unknown property type");
+			elements.back().properties.push_back(prop);
+		}
+	}
+
+	if (!binary)
+		return fail("only binary ply files are supported");
+
+	for (auto& e : elements) {
+		size_t offset = 0;
+		bool fixed = true;
+		for (auto& prop : e.properties) {
+			prop.offset = offset;
+			if (prop.count_type != scalar::none) fixed = false;
+			offset += scalar_size(prop.type);
+		}
+		e.stride = fixed ? offset : 0;
+	}
+
+	const char* vertex_data = nullptr;
+	const char* face_data = nullptr;
+	const element* vertices = nullptr;
+	const element* faces = nullptr;
+
+	//walk over the elements to find where vertices and faces start, anything else gets skipped
+	for (size_t i = 0; i < elements.size(); i++) {
+		const auto& e = elements[i];
+		if (e.name == "vertex") { vertices = &e; vertex_data = data + p; }
+		if (e.name == "face") { faces = &e; face_data = data + p; }
+
+		bool last = i + 1 == elements.size();
+		if (e.stride) {
+			//divided rather than multiplied, a made up count could wrap the product around
+			if (e.count > (size - p) / e.stride)
+				return fail("file is truncated");
+			p += e.stride * e.count;
+		}
+		else if (!last) {
+			for (size_t k = 0; k < e.count; k++) {
+				size_t bytes;
+				if (!element_size(e, data + p, data + size, swap, bytes))
+					return fail("file is truncated");
+				p += bytes;
+			}
+		}
+		if (p > size)
+			return fail("file is truncated");
+	}
+
+	if (!vertices || !faces || vertices->stride == 0)
+		return fail("needs a vertex element with fixed size properties and a face element");
+
+	int px = vertices->find("x"), py = vertices->find("y"), pz = vertices->find("z");
+	int nx = vertices->find("nx"), ny = vertices->find("ny"), nz = vertices->find("nz");
+	int tu = vertices->find("u"), tv = vertices->find("v");
+	if (tu < 0) { tu = vertices->find("s"); tv = vertices->find("t"); }
+	if (tu < 0) { tu = vertices->find("texture_u"); tv = vertices->find("texture_v"); }
+	if (px < 0 || py < 0 || pz < 0)
+		return fail("vertices have no x, y or z");
+
+	int face_list = faces->find("vertex_indices");
+	if (face_list < 0) face_list = faces->find("vertex_index");
+	if (face_list < 0 || faces->properties[face_list].count_type == scalar::none)
+		return fail("faces have no vertex_indices list");
+
+	auto vertex_count = vertices->count;
+	auto threads = loader_thread_count();
+	bool has_normals = nx >= 0 && ny >= 0 && nz >= 0;
+	bool has_uvs = tu >= 0 && tv >= 0;
+
+	mesh->positions.resize(vertex_count);
+	if (has_normals) mesh->normals.resize(vertex_count);
+	if (has_uvs) mesh->uvs.resize(2 * vertex_count);
+
+	parallel_chunks(threads, [&](size_t c) {
+		auto get = [&](const char* v, int prop) {
+			const auto& pr = vertices->properties[prop];
+			return static_cast<float>(read_scalar(v + pr.offset, pr.type, swap));
+		};
+		for (size_t i = vertex_count * c / threads; i < vertex_count * (c + 1) / threads; i++) {
+			auto v = vertex_data + i * vertices->stride;
+			mesh->positions[i] = point3(get(v, px), get(v, py), get(v, pz));
+			if (has_normals) mesh->normals[i] = vec3(get(v, nx), get(v, ny), get(v, nz));
+			if (has_uvs) {
+				mesh->uvs[2 * i] = get(v, tu);
+				mesh->uvs[2 * i + 1] = get(v, tv);
+			}
+		}
+	});
+
+	const auto& list = faces->properties[face_list];
+	auto count_size = scalar_size(list.count_type);
+	auto index_size = scalar_size(list.type);
+	auto face_count = faces->count;
+	bool valid = true;
+
+	//fast path: only the index list, all triangles, so every face is the same size
+	auto triangle_stride = count_size + 3 * index_size;
+	bool fixed = faces->properties.size() == 1 && faces == &elements.back()
+		&& static_cast<size_t>(data + size - face_data) % triangle_stride == 0
+		&& static_cast<size_t>(data + size - face_data) / triangle_stride == face_count;
+
+	if (fixed) {
+		mesh->indices.resize(3 * face_count);
+		//one flag per chunk, a non-triangle sends everything down the slow path below
+		std::vector<char> triangles_only(threads, 1), indices_ok(threads, 1);
+		parallel_chunks(threads, [&](size_t c) {
+			for (size_t i = face_count * c / threads; i < face_count * (c + 1) / threads; i++) {
+				auto f = face_data + i * triangle_stride;
+				if (read_scalar(f, list.count_type, swap) != 3) {
+					triangles_only[c] = 0;
+					return;
+				}
+				for (int k = 0; k < 3; k++) {
+					auto index = static_cast<long long>(read_scalar(f + count_size + k * index_size, list.type, swap));
+					if (index < 0 || index >= static_cast<long long>(vertex_count)) indices_ok[c] = 0;
+					mesh->indices[3 * i + k] = static_cast<uint32_t>(index);
+				}
+			}
+		});
+		auto all = [](const std::vector<char>& flags) { return std::all_of(flags.begin(), flags.end(), [](char f) { return f != 0; }); };
+		fixed = all(triangles_only);
+		valid = all(indices_ok);
+	}
+
+	if (!fixed) {
+		//mixed polygons or extra properties, count first so the index buffer is allocated once
+		size_t list_offset = 0;
+		for (int k = 0; k < face_list; k++)
+			list_offset += scalar_size(faces->properties[k].type);
+
+		//every face has to fit into the file before anything in it gets read, including the corners of its list
+		auto face_fits = [&](const char* f, size_t& bytes) {
+			if (!element_size(*faces, f, data + size, swap, bytes) || list_offset + count_size > bytes)
+				return false;
+			auto corners = static_cast<size_t>(read_scalar(f + list_offset, list.count_type, swap));
+			return corners <= (bytes - list_offset - count_size) / index_size;
+		};
+
+		size_t triangles = 0;
+		auto f = face_data;
+		for (size_t i = 0; i < face_count; i++) {
+			size_t bytes;
+			if (!face_fits(f, bytes))
+				return fail("file is truncated");
+			auto corners = static_cast<size_t>(read_scalar(f + list_offset, list.count_type, swap));
+			if (corners >= 3) triangles += corners - 2;
+			f += bytes;
+		}
+
+		mesh->indices.clear();
+		mesh->indices.reserve(3 * triangles);
+
+		f = face_data;
+		for (size_t i = 0; i < face_count; i++) {
+			size_t bytes;
+			if (!face_fits(f, bytes))
+				return fail("file is truncated");
+			auto l = f + list_offset;
+			auto corners = static_cast<size_t>(read_scalar(l, list.count_type, swap));
+			auto index = [&](size_t k) {
+				auto v = static_cast<long long>(read_scalar(l + count_size + k * index_size, list.type, swap));
+				if (v < 0 || v >= static_cast<long long>(vertex_count)) { valid = false; v = 0; }
+				return static_cast<uint32_t>(v);
+			};
+			for (size_t k = 1; k + 1 < corners; k++) {
+				mesh->indices.push_back(index(0));
+				mesh->indices.push_back(index(k));
+				mesh->indices.push_back(index(k + 1));
+			}
+			f += bytes;
+		}
+	}
+
+	if (!valid)
+		return fail("faces have invalid vertex indices");
+
+	return mesh;
+}
+
+//picks the loader from the file extension
+shared_ptr<triangle_mesh> load_mesh(const char* filename, shared_ptr<material> m) {
+	std::string name(filename);
+	auto dot_pos = name.find_last_of('.');
+	std::string extension = dot_pos == std::string::npos ? "" : name.substr(dot_pos + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+
+	if (extension == "ply")
+		return load_ply(filename, m);
+	return load_obj(filename, m);
+}
+
+#endif // !MESH_LOADER_H
@@ -0,0 +1,26 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "common.h"
+#include "vec3.h"
+
+//orthonormal basis with w along a given direction, turns directions sampled around the z axis into world space.
+//closed form from Duff et al. 2017, no normalizing and no branching on which axis to cross with
+class onb {
+public:
+	onb(const vec3& n) : w(n) {
+		auto sign = std::copysign(1.0f, n.z());
+		auto a = -1 / (sign + n.z());
+		auto b = n.x() * n.y() * a;
+		u = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+		v = vec3(b, sign + n.y() * n.y() * a, -n.y());
+	}
+
+	vec3 local(float a, float b, float c) const { return a * u + b * v + c * w; }
+	vec3 local(const vec3& a) const { return local(a.x(), a.y(), a.z()); }
+
+public:
+	vec3 u, v, w;
+};
+
+#endif // !ONB_H
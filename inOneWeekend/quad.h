@@ -6,11 +6,13 @@
 
 #include "common.h"
 #include "hittable.h"
+#include "material_table.h"
 #include "hittable_list.h"
+#include "instance.h"
 
 class quad : public hittable {
 public:
-	quad(const point3& _q, const vec3& _u, const vec3& _v, shared_ptr<material> m) : q(_q), u(_u), v(_v), mat(m) {
+	quad(const point3& _q, const vec3& _u, const vec3& _v, shared_ptr<material> m) : q(_q), u(_u), v(_v), mat_id(scene_materials().add(m)) {
 		auto n = cross(u, v);
 		normal = unit_vector(n);
 		d = -dot(normal, q);
@@ -20,10 +22,14 @@ public:
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
 
+	//uniformly distributed point on the quad for s and t in [0, 1), used for sampling lights
+	void sample_surface(float s, float t, hit_record& rec) const;
+	float area() const { return cross(u, v).length(); }
+
 public:
 	point3 q;
 	vec3 u, v;
-	shared_ptr<material> mat;
+	uint32_t mat_id;
 	vec3 normal;
 	double d;
 	vec3 w;
@@ -48,29 +54,44 @@ bool quad::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 	rec.v = b;
 	rec.t = t;
 	rec.p = at;
-	rec.mat_ptr = mat;
+	rec.mat_id = mat_id;
 	rec.set_face_normal(r, normal);
 	return true;
 }
 
+void quad::sample_surface(float s, float t, hit_record& rec) const {
+	rec.p = q + s * u + t * v;
+	rec.u = s;
+	rec.v = t;
+	rec.normal = normal;
+	rec.front_face = true;
+	rec.mat_id = mat_id;
+}
+
 bool quad::bounding_box(float time0, float time1, aabb& output_box) const {
-	output_box = aabb(q, q + u + v);
+	//both diagonals, otherwise quads that aren't axis aligned stick out of their box
+	output_box = surrounding_box(aabb(q, q + u + v), aabb(q + u, q + v)).padded();
 	return true;
 }
 
-class box : public hittable {
+//a box is a unit cube stretched into place, every box shares the same six quads and paints them with its own material.
+//flat boxes can't be stretched from a cube, they get quads of their own
+class box : public instance {
 public:
 	box() {}
 	box(const point3& a, const point3& b, shared_ptr<material> mat);
 	box(const point3& origin, const vec3& a, const vec3& b, const vec3& height, shared_ptr<material> mat);
 
-	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
-	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+private:
+	//the sides of the box x, y and z span from origin, the two constructors lay them out differently
+	static shared_ptr<hittable_list> corner_sides(const point3& origin, const vec3& x, const vec3& y, const vec3& z, shared_ptr<material> mat);
+	static shared_ptr<hittable_list> spanned_sides(const point3& origin, const vec3& x, const vec3& y, const vec3& z, shared_ptr<material> mat);
 
-public:
-	point3 box_min;
-	point3 box_max;
-	hittable_list sides;
+	//what the shared cubes are built with, every box overrides it
+	static shared_ptr<material> placeholder() {
+		static auto mat = make_shared<lambertian>(color(0, 0, 0));
+		return mat;
+	}
 };
 
 box::box(const point3& a, const point3& b, shared_ptr<material> mat)
@@ -84,35 +105,47 @@ box::box(const point3& a, const point3& b, shared_ptr<material> mat)
 	auto dx = vec3(max.x() - min.x(), 0, 0);
 	auto dy = vec3(0, max.y() - min.y(), 0);
 	auto dz = vec3(0, 0, max.z() - min.z());
-																							  
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));  // front	  
-	sides.add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right	  
-	sides.add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back	  
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));  // left	  
-	sides.add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top	  
-	sides.add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));  // bottom  
+
+	static auto cube = corner_sides(point3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1), placeholder());
+	auto to_world = affine::basis(min, dx, dy, dz);
+	if (to_world.determinant() != 0)
+		instance::operator=(instance(cube, to_world, mat));
+	else
+		instance::operator=(instance(corner_sides(min, dx, dy, dz, mat), affine::identity(), mat));
 }
 
 box::box(const point3& origin, const vec3& a, const vec3& b, const vec3& height, shared_ptr<material> mat)
 {
-	sides.add(make_shared<quad>(origin, a, height, mat));  // front	  
-	sides.add(make_shared<quad>(origin+b, a, height, mat)); // back	 
-
-	sides.add(make_shared<quad>(origin, b, height, mat)); // left  
-	sides.add(make_shared<quad>(origin+a, b, height, mat));  // right
-
-	sides.add(make_shared<quad>(origin+height, a, b, mat)); // top	  
-	sides.add(make_shared<quad>(origin, a, b, mat));  // bottom  
+	static auto cube = spanned_sides(point3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1), placeholder());
+	auto to_world = affine::basis(origin, a, b, height);
+	if (to_world.determinant() != 0)
+		instance::operator=(instance(cube, to_world, mat));
+	else
+		instance::operator=(instance(spanned_sides(origin, a, b, height, mat), affine::identity(), mat));
 }
 
-bool box::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-	return sides.hit(r, t_min, t_max, rec);
+shared_ptr<hittable_list> box::corner_sides(const point3& origin, const vec3& x, const vec3& y, const vec3& z, shared_ptr<material> mat) {
+	auto sides = make_shared<hittable_list>();
+	sides->add(make_shared<quad>(origin + z, x, y, mat));		// front
+	sides->add(make_shared<quad>(origin + x + z, -z, y, mat));	// right
+	sides->add(make_shared<quad>(origin + x, -x, y, mat));		// back
+	sides->add(make_shared<quad>(origin, z, y, mat));			// left
+	sides->add(make_shared<quad>(origin + y + z, x, -z, mat));	// top
+	sides->add(make_shared<quad>(origin, x, z, mat));			// bottom
+	return sides;
 }
 
-bool box::bounding_box(float time0, float time1, aabb& output_box) const {
-	output_box = aabb(box_min, box_max);
-	return true;
-}
+shared_ptr<hittable_list> box::spanned_sides(const point3& origin, const vec3& x, const vec3& y, const vec3& z, shared_ptr<material> mat) {
+	auto sides = make_shared<hittable_list>();
+	sides->add(make_shared<quad>(origin, x, z, mat));			// front
+	sides->add(make_shared<quad>(origin + y, x, z, mat));		// back
+
+	sides->add(make_shared<quad>(origin, y, z, mat));			// left
+	sides->add(make_shared<quad>(origin + x, y, z, mat));		// right
 
+	sides->add(make_shared<quad>(origin + z, x, y, mat));		// top
+	sides->add(make_shared<quad>(origin, x, y, mat));			// bottom
+	return sides;
+}
 
 #endif // !QUAD_H
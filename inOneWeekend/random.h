@@ -0,0 +1,60 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+//PCG32 (XSH RR variant) by Melissa O'Neill, https://www.pcg-random.org
+//small state, fast and, unlike rand(), every thread gets its own
+class pcg32 {
+public:
+	pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+	pcg32(uint64_t initState, uint64_t stream) { seed(initState, stream); }
+
+	//every stream is its own sequence, two generators with different streams won't overlap
+	void seed(uint64_t initState, uint64_t stream) {
+		state = 0;
+		inc = (stream << 1u) | 1u;
+		next_uint();
+		state += initState;
+		next_uint();
+	}
+
+	uint32_t next_uint() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = static_cast<uint32_t>(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+	}
+
+	float next_float() {
+		//top 24 bits, so the result fits a float exactly and stays below 1
+		return (next_uint() >> 8) * (1.0f / 16777216.0f);
+	}
+
+public:
+	uint64_t state;
+	uint64_t inc;
+};
+
+//scrambles a 64 bit value, used to turn neighbouring seeds into unrelated ones
+inline uint64_t splitmix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+//seed of the whole render, change it to get a different noise pattern
+inline uint64_t& render_seed() {
+	static uint64_t seed = 0;
+	return seed;
+}
+
+//the generator the calling thread draws from, no locks, no shared state
+inline pcg32& thread_rng() {
+	thread_local pcg32 rng;
+	return rng;
+}
+
+#endif // !RANDOM_H
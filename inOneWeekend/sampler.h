@@ -0,0 +1,212 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+
+#include "random.h"
+
+//where the random numbers of a pixel sample come from.
+//every request is one dimension of the sample (pixel jitter, lens, light pick, bounce direction, ...) in the order
+//the path asks for them. 2d requests get two values that are stratified against each other, so the pixel area,
+//the lens or a light get covered evenly across the samples of a pixel instead of clumping
+class sampler {
+public:
+	virtual ~sampler() {}
+
+	//called before every pixel sample
+	virtual void start(uint32_t x, uint32_t y, uint32_t sample) = 0;
+
+	virtual float next_1d() = 0;
+	virtual void next_2d(float& a, float& b) = 0;
+};
+
+enum class sampler_type {
+	independent,	//plain pcg32, every value on its own
+	sobol,			//owen scrambled sobol, scrambled differently for every pixel
+	blue_noise		//the same sobol points in every pixel, shifted by a blue noise value per pixel
+};
+
+//sampler of the whole render
+inline sampler_type& render_sampler() {
+	static sampler_type type = sampler_type::sobol;
+	return type;
+}
+
+//one pcg32 stream per pixel sample, the same numbers the renderer used before there were samplers
+class independent_sampler : public sampler {
+public:
+	virtual void start(uint32_t x, uint32_t y, uint32_t sample) override {
+		rng.seed(splitmix64(render_seed() ^ splitmix64(sample)), (static_cast<uint64_t>(y) << 32) | x);
+	}
+
+	virtual float next_1d() override {
+		return rng.next_float();
+	}
+
+	virtual void next_2d(float& a, float& b) override {
+		a = rng.next_float();
+		b = rng.next_float();
+	}
+
+private:
+	pcg32 rng;
+};
+
+namespace sobol_detail {
+	inline uint32_t reverse_bits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	//owen scrambling with a hash, see Burley 2020 "Practical Hash-based Owen Scrambling".
+	//every bit gets flipped depending on the bits above it, which keeps the sobol stratification intact
+	inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+		return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+	}
+
+	inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+		return seed ^ (v + (seed << 6) + (seed >> 2));
+	}
+
+	inline uint32_t hash(uint32_t x) {
+		x ^= x >> 17;
+		x *= 0xed5ad4bbu;
+		x ^= x >> 11;
+		x *= 0xac4c1b51u;
+		x ^= x >> 15;
+		x *= 0x31848babu;
+		x ^= x >> 14;
+		return x;
+	}
+
+	//second dimension of the 2d sobol sequence, the first one is just the reversed index
+	inline uint32_t sobol_second(uint32_t index) {
+		uint32_t result = 0;
+		for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+			if (index & 1)
+				result ^= v;
+		return result;
+	}
+
+	inline float to_float(uint32_t x) {
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+
+	//interleaved gradient noise (Jimenez 2014), a cheap value per pixel whose neighbours are as different as possible
+	inline float gradient_noise(float x, float y) {
+		auto f = 0.06711056f * x + 0.00583715f * y;
+		f = 52.9829189f * (f - static_cast<int>(f));
+		return f - static_cast<int>(f);
+	}
+}
+
+//"padded" sobol: every request gets its own 2d sobol sequence with its own scramble,
+//the sample index is shuffled per request too so the dimensions don't line up with each other.
+//past max_dimensions a path is deep enough that stratification hardly matters, those values come from pcg32
+class sobol_sampler : public sampler {
+public:
+	static const uint32_t max_dimensions = 64;
+
+	sobol_sampler(bool blueNoise = false) : blue_noise(blueNoise) {}
+
+	virtual void start(uint32_t x, uint32_t y, uint32_t sample) override {
+		auto seed = static_cast<uint32_t>(render_seed() ^ (render_seed() >> 32));
+		pixel_seed = blue_noise ? sobol_detail::hash(seed) : sobol_detail::hash(seed ^ sobol_detail::hash(x ^ sobol_detail::hash(y)));
+		pixel_x = static_cast<float>(x);
+		pixel_y = static_cast<float>(y);
+		index = sample;
+		dimension = 0;
+		fallback.seed(splitmix64(render_seed() ^ splitmix64(sample)), (static_cast<uint64_t>(y) << 32) | x);
+	}
+
+	virtual float next_1d() override {
+		if (dimension >= max_dimensions)
+			return fallback.next_float();
+
+		auto seed = sobol_detail::hash_combine(pixel_seed, dimension);
+		auto i = sobol_detail::nested_uniform_scramble(index, seed);
+		auto a = sobol_detail::to_float(sobol_detail::nested_uniform_scramble(sobol_detail::reverse_bits(i), sobol_detail::hash_combine(seed, 0)));
+		return shift(a, 2 * dimension++);
+	}
+
+	virtual void next_2d(float& a, float& b) override {
+		if (dimension >= max_dimensions) {
+			a = fallback.next_float();
+			b = fallback.next_float();
+			return;
+		}
+
+		auto seed = sobol_detail::hash_combine(pixel_seed, dimension);
+		auto i = sobol_detail::nested_uniform_scramble(index, seed);
+		a = sobol_detail::to_float(sobol_detail::nested_uniform_scramble(sobol_detail::reverse_bits(i), sobol_detail::hash_combine(seed, 0)));
+		b = sobol_detail::to_float(sobol_detail::nested_uniform_scramble(sobol_detail::sobol_second(i), sobol_detail::hash_combine(seed, 1)));
+		a = shift(a, 2 * dimension);
+		b = shift(b, 2 * dimension + 1);
+		dimension++;
+	}
+
+private:
+	//blue noise: every pixel gets the same points, moved around the unit square by a value that differs a lot
+	//from the neighbouring pixels. the error ends up as fine grained noise instead of clumps
+	float shift(float value, uint32_t d) const {
+		if (!blue_noise)
+			return value;
+		value += sobol_detail::gradient_noise(pixel_x + 5.588238f * d, pixel_y + 5.588238f * d);
+		return value < 1 ? value : value - 1;
+	}
+
+	bool blue_noise;
+	uint32_t pixel_seed = 0;
+	float pixel_x = 0, pixel_y = 0;
+	uint32_t index = 0;
+	uint32_t dimension = 0;
+	pcg32 fallback;
+};
+
+//a sampler of its own, for code that keeps several pixel samples going at once (see wavefront.h)
+inline std::unique_ptr<sampler> make_sampler(sampler_type type) {
+	switch (type) {
+	case sampler_type::sobol:		return std::make_unique<sobol_sampler>(false);
+	case sampler_type::blue_noise:	return std::make_unique<sobol_sampler>(true);
+	default:						return std::make_unique<independent_sampler>();
+	}
+}
+
+//the sampler the calling thread draws from, nullptr until the first pixel sample
+inline sampler*& current_sampler() {
+	thread_local sampler* current = nullptr;
+	return current;
+}
+
+//puts the calling thread on one pixel sample, everything random_float returns after this belongs to it.
+//samples don't depend on which thread renders them, so the image is the same for any thread count
+inline void start_pixel_sample(uint32_t x, uint32_t y, uint32_t sample) {
+	thread_local independent_sampler independent;
+	thread_local sobol_sampler sobol(false);
+	thread_local sobol_sampler blue_noise(true);
+
+	sampler* s = &independent;
+	if (render_sampler() == sampler_type::sobol)
+		s = &sobol;
+	else if (render_sampler() == sampler_type::blue_noise)
+		s = &blue_noise;
+
+	s->start(x, y, sample);
+	current_sampler() = s;
+}
+
+#endif // !SAMPLER_H
@@ -0,0 +1,709 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "material_table.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+#include "wide_bvh.h"
+
+//the compiled scene written to disk: bvh nodes, primitives, mesh buffers, materials and decoded texels.
+//the file is a header, a table of sections and the sections themselves, each one starting on a 64 byte boundary.
+//loading maps the file and points the bvh, the meshes and the image textures straight at it,
+//only the few spheres, quads, triangles and materials are rebuilt as objects.
+//a cache is only used if it was written by the same build and none of the files it was built from changed
+
+//bump whenever the layout of anything written below changes
+const uint32_t scene_cache_version = 1;
+
+namespace cache_detail {
+	const size_t alignment = 64;
+	const uint32_t none = UINT32_MAX;
+
+	enum section_id : uint32_t {
+		dependencies_section, textures_section, texels_section, materials_section,
+		spheres_section, quads_section, triangles_section,
+		meshes_section, mesh_data_section, mesh_materials_section,
+		refs_section, nodes_section
+	};
+
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t section_count;
+		uint64_t key;
+		uint32_t bvh_width;
+		float box_min[3];
+		float box_max[3];
+		uint32_t pad;
+	};
+
+	struct section {
+		uint32_t id;
+		uint32_t pad;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	//a file the scene was built from, followed by its name padded to 8 bytes
+	struct dependency_record {
+		uint64_t size;		//UINT64_MAX if the file didn't exist
+		int64_t time;
+		uint32_t name_length;
+		uint32_t pad;
+	};
+
+	enum class texture_type : uint32_t { solid, checker, image, greyscale };
+
+	struct texture_record {
+		texture_type type;
+		uint32_t even, odd;			//checker
+		int32_t width, height;		//image and greyscale
+		uint32_t file;				//dependency the texels came from
+		uint64_t texel_offset;		//into the texel section, UINT64_MAX if the image didn't load
+		float value[3];				//solid color
+		uint32_t pad;
+	};
+
+	enum class material_type : uint32_t { lambertian, metal, dielectric, diffuse_light };
+
+	struct material_record {
+		material_type type;
+		uint32_t albedo;
+		uint32_t second;			//fuzz for metal, emit_map for diffuse_light
+		float ir;					//dielectric
+	};
+
+	struct sphere_record { float center[3]; float radius; uint32_t material; };
+	struct quad_record { float q[3], u[3], v[3]; uint32_t material; };
+	struct triangle_record { float v[3][3]; uint32_t material; };
+
+	//byte offsets into the mesh data section
+	struct mesh_record {
+		uint64_t positions, normals, uvs, indices, face_materials;
+		uint64_t position_count, normal_count, uv_count, index_count, face_material_count;
+		uint32_t first_material, material_count;	//into the mesh material section
+		uint32_t source;							//dependency the mesh was loaded from
+		uint32_t pad;
+	};
+
+	//FNV-1a, only used to fold the cache key together
+	inline uint64_t hash_bytes(const void* data, size_t size, uint64_t h = 14695981039346656037ULL) {
+		auto bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+			h = (h ^ bytes[i]) * 1099511628211ULL;
+		return h;
+	}
+
+	inline void pad_to(std::vector<char>& bytes, size_t align) {
+		bytes.resize((bytes.size() + align - 1) / align * align);
+	}
+
+	template <typename T>
+	size_t append(std::vector<char>& bytes, const T* data, size_t count) {
+		pad_to(bytes, alignment);
+		auto offset = bytes.size();
+		bytes.resize(offset + count * sizeof(T));
+		if (count)
+			memcpy(bytes.data() + offset, data, count * sizeof(T));
+		return offset;
+	}
+
+	inline dependency_record stat_file(const std::string& name) {
+		dependency_record d = {};
+		std::error_code ec;
+		auto size = std::filesystem::file_size(name, ec);
+		if (ec) {
+			d.size = UINT64_MAX;
+			return d;
+		}
+		d.size = size;
+		d.time = static_cast<int64_t>(std::filesystem::last_write_time(name, ec).time_since_epoch().count());
+		return d;
+	}
+
+	inline void to_floats(const vec3& v, float* out) {
+		out[0] = v.x();
+		out[1] = v.y();
+		out[2] = v.z();
+	}
+
+	//count elements of T starting offset bytes into a section of size bytes, without overflowing on garbage
+	template <typename T>
+	bool fits(uint64_t offset, uint64_t count, size_t size) {
+		return offset <= size && offset % alignof(T) == 0 && count <= (size - offset) / sizeof(T);
+	}
+
+	//a damaged node could send the traversal anywhere, so children have to come after their parent
+	//(which also rules out loops), stay no deeper than the traversal stacks and leaves inside the refs
+	inline bool nodes_intact(const linear_bvh_node* nodes, size_t count, size_t ref_count) {
+		std::vector<int> depth(count, 0);
+		for (size_t i = 0; i < count; i++) {
+			const auto& node = nodes[i];
+			if (node.is_leaf()) {
+				if (node.offset > ref_count || node.count > ref_count - node.offset)
+					return false;
+				continue;
+			}
+			if (node.axis > 2 || i + 1 >= count || node.offset <= i || node.offset >= count || depth[i] + 1 >= linear_bvh::max_depth)
+				return false;
+			depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+			depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+		}
+		return true;
+	}
+
+	template <int N>
+	bool nodes_intact(const wide_bvh_node<N>* nodes, size_t count, size_t ref_count) {
+		std::vector<int> depth(count, 0);
+		for (size_t i = 0; i < count; i++) {
+			const auto& node = nodes[i];
+			if (node.children > N)
+				return false;
+			for (int c = 0; c < node.children; c++) {
+				auto child = node.child[c];
+				if (node.count[c] != 0) {
+					if (child > ref_count || node.count[c] > ref_count - child)
+						return false;
+					continue;
+				}
+				if (child <= i || child >= count || depth[i] + 1 >= linear_bvh::max_depth)
+					return false;
+				depth[child] = std::max(depth[child], depth[i] + 1);
+			}
+		}
+		return true;
+	}
+}
+
+class scene_cache {
+public:
+	//build_id should change whenever the code that builds the scene does, e.g. __DATE__ " " __TIME__
+	scene_cache(const char* file, const char* build_id);
+
+	//maps the cache and returns the bvh stored in it, nullptr if there is no cache or it's out of date
+	std::unique_ptr<hittable> load();
+
+	//writes the compiled scene for the next run, bvh has to come from build_bvh
+	bool save(const hittable& bvh);
+
+private:
+	bool load_dependencies(const char* data, size_t size);
+
+	std::string filename;
+	uint64_t key;
+	int width;
+
+	//keeps the mapping alive, everything load() returns points into it
+	std::unique_ptr<mapped_file> file;
+	std::vector<std::string> dependency_names;
+};
+
+scene_cache::scene_cache(const char* file, const char* build_id) : filename(file), width(bvh_width()) {
+	using namespace cache_detail;
+
+	//anything that changes the meaning or layout of the bytes goes into the key
+	key = hash_bytes(build_id, strlen(build_id));
+	size_t layout[] = { scene_cache_version, static_cast<size_t>(width), sizeof(vec3), sizeof(linear_bvh_node),
+		sizeof(wide_bvh_node<4>), sizeof(wide_bvh_node<8>) };
+	key = hash_bytes(layout, sizeof(layout), key);
+}
+
+bool scene_cache::load_dependencies(const char* data, size_t size) {
+	using namespace cache_detail;
+
+	size_t p = 0;
+	while (p + sizeof(dependency_record) <= size) {
+		dependency_record d;
+		memcpy(&d, data + p, sizeof(d));
+		p += sizeof(d);
+		if (p + d.name_length > size)
+			return false;
+
+		std::string name(data + p, d.name_length);
+		p += (d.name_length + 7) / 8 * 8;
+
+		auto now = stat_file(name);
+		if (now.size != d.size || now.time != d.time) {
+			std::cerr << "Scene cache is out of date, " << name << " changed.\n";
+			return false;
+		}
+		dependency_names.push_back(name);
+	}
+	return true;
+}
+
+std::unique_ptr<hittable> scene_cache::load() {
+	using namespace cache_detail;
+
+	file = std::make_unique<mapped_file>(filename.c_str());
+	if (!file->is_open())
+		return nullptr;
+
+	auto data = file->data();
+	auto size = file->size();
+
+	header h;
+	if (size < sizeof(h))
+		return nullptr;
+	memcpy(&h, data, sizeof(h));
+	if (memcmp(h.magic, "RTSCENE", 8) != 0 || h.version != scene_cache_version || h.key != key
+		|| h.bvh_width != static_cast<uint32_t>(width) || size < sizeof(h) + h.section_count * sizeof(section)) {
+		std::cerr << "Scene cache is out of date, rebuilding.\n";
+		return nullptr;
+	}
+
+	//looks up a section and checks that it's inside the file, a cut off file just means no cache
+	auto sections = reinterpret_cast<const section*>(data + sizeof(h));
+	bool intact = true;
+	auto find = [&](section_id id, size_t& count, size_t element_size) -> const char* {
+		for (uint32_t i = 0; i < h.section_count; i++) {
+			if (sections[i].id != id)
+				continue;
+			if (sections[i].offset > size || sections[i].size > size - sections[i].offset
+				|| sections[i].offset % alignment != 0 || sections[i].size % element_size != 0)
+				break;
+			count = sections[i].size / element_size;
+			return data + sections[i].offset;
+		}
+		intact = false;
+		count = 0;
+		return nullptr;
+	};
+
+	size_t n;
+	auto dependency_data = find(dependencies_section, n, 1);
+	if (!intact || !load_dependencies(dependency_data, n))
+		return nullptr;
+
+	size_t texture_count, texel_bytes, material_count, sphere_count, quad_count, triangle_count;
+	size_t mesh_count, mesh_bytes, mesh_material_count, ref_count, node_count;
+	auto textures = reinterpret_cast<const texture_record*>(find(textures_section, texture_count, sizeof(texture_record)));
+	auto texels = reinterpret_cast<const unsigned char*>(find(texels_section, texel_bytes, 1));
+	auto materials = reinterpret_cast<const material_record*>(find(materials_section, material_count, sizeof(material_record)));
+	auto spheres = reinterpret_cast<const sphere_record*>(find(spheres_section, sphere_count, sizeof(sphere_record)));
+	auto quads = reinterpret_cast<const quad_record*>(find(quads_section, quad_count, sizeof(quad_record)));
+	auto triangles = reinterpret_cast<const triangle_record*>(find(triangles_section, triangle_count, sizeof(triangle_record)));
+	auto meshes = reinterpret_cast<const mesh_record*>(find(meshes_section, mesh_count, sizeof(mesh_record)));
+	auto mesh_data = find(mesh_data_section, mesh_bytes, 1);
+	auto mesh_materials = reinterpret_cast<const uint32_t*>(find(mesh_materials_section, mesh_material_count, sizeof(uint32_t)));
+	auto refs = reinterpret_cast<const uint32_t*>(find(refs_section, ref_count, sizeof(uint32_t)));
+	size_t node_size = width == 8 ? sizeof(wide_bvh_node<8>) : width == 4 ? sizeof(wide_bvh_node<4>) : sizeof(linear_bvh_node);
+	auto nodes = find(nodes_section, node_count, node_size);
+
+	//from here on every index and offset read from the file gets checked before it's used
+	auto damaged = []() -> std::unique_ptr<hittable> {
+		std::cerr << "Scene cache is damaged, rebuilding.\n";
+		return nullptr;
+	};
+	if (!intact)
+		return damaged();
+
+	auto dependency = [&](uint32_t i) { return i < dependency_names.size() ? dependency_names[i] : std::string(); };
+
+	//textures and materials only ever reference ones written before them
+	std::vector<shared_ptr<texture>> texture_table;
+	for (size_t i = 0; i < texture_count; i++) {
+		const auto& t = textures[i];
+		switch (t.type) {
+		case texture_type::solid:
+			texture_table.push_back(make_shared<solid_color>(color(t.value[0], t.value[1], t.value[2])));
+			break;
+		case texture_type::checker:
+			if (t.even >= i || t.odd >= i)
+				return damaged();
+			texture_table.push_back(make_shared<checker_texture>(texture_table[t.even], texture_table[t.odd]));
+			break;
+		case texture_type::image:
+		case texture_type::greyscale: {
+			//the size is kept even when the image didn't load, the scanline length still has to fit in an int
+			int bytes_per_pixel = t.type == texture_type::image ? image_texture::bytes_per_pixel : greyscale::bytes_per_pixel;
+			if (t.width < 0 || t.height < 0 || t.width > INT32_MAX / bytes_per_pixel)
+				return damaged();
+			const unsigned char* pixels = nullptr;
+			if (t.texel_offset != UINT64_MAX) {
+				uint64_t bytes = static_cast<uint64_t>(bytes_per_pixel) * t.width * t.height;
+				if (t.width == 0 || t.height == 0 || !fits<unsigned char>(t.texel_offset, bytes, texel_bytes))
+					return damaged();
+				pixels = texels + t.texel_offset;
+			}
+			if (t.type == texture_type::image)
+				texture_table.push_back(make_shared<image_texture>(pixels, t.width, t.height, dependency(t.file)));
+			else
+				texture_table.push_back(make_shared<greyscale>(pixels, t.width, t.height, dependency(t.file)));
+			break;
+		}
+		default:
+			return damaged();
+		}
+	}
+
+	std::vector<shared_ptr<material>> material_table;
+	for (size_t i = 0; i < material_count; i++) {
+		const auto& m = materials[i];
+		if (m.type != material_type::dielectric && (m.albedo >= texture_count || m.second >= texture_count))
+			return damaged();
+		switch (m.type) {
+		case material_type::lambertian:		material_table.push_back(make_shared<lambertian>(texture_table[m.albedo])); break;
+		case material_type::metal:			material_table.push_back(make_shared<metal>(texture_table[m.albedo], texture_table[m.second])); break;
+		case material_type::dielectric:		material_table.push_back(make_shared<dielectric>(m.ir)); break;
+		case material_type::diffuse_light:	material_table.push_back(make_shared<diffuse_light>(texture_table[m.albedo], texture_table[m.second])); break;
+		default:							return damaged();
+		}
+	}
+
+	//the typed arrays have to come back in the same order, the refs index into them
+	primitive_store prims;
+	auto p3 = [](const float* f) { return point3(f[0], f[1], f[2]); };
+	prims.spheres.reserve(sphere_count);
+	for (size_t i = 0; i < sphere_count; i++) {
+		if (spheres[i].material >= material_count)
+			return damaged();
+		prims.spheres.emplace_back(p3(spheres[i].center), spheres[i].radius, material_table[spheres[i].material]);
+	}
+	prims.quads.reserve(quad_count);
+	for (size_t i = 0; i < quad_count; i++) {
+		if (quads[i].material >= material_count)
+			return damaged();
+		prims.quads.emplace_back(p3(quads[i].q), p3(quads[i].u), p3(quads[i].v), material_table[quads[i].material]);
+	}
+	prims.triangles.reserve(triangle_count);
+	for (size_t i = 0; i < triangle_count; i++) {
+		if (triangles[i].material >= material_count)
+			return damaged();
+		prims.triangles.emplace_back(p3(triangles[i].v[0]), p3(triangles[i].v[1]), p3(triangles[i].v[2]), material_table[triangles[i].material]);
+	}
+
+	for (size_t i = 0; i < mesh_count; i++) {
+		const auto& m = meshes[i];
+		if (!fits<point3>(m.positions, m.position_count, mesh_bytes) || !fits<vec3>(m.normals, m.normal_count, mesh_bytes)
+			|| !fits<float>(m.uvs, m.uv_count, mesh_bytes) || !fits<uint32_t>(m.indices, m.index_count, mesh_bytes)
+			|| !fits<uint16_t>(m.face_materials, m.face_material_count, mesh_bytes)
+			|| m.first_material > mesh_material_count || m.material_count > mesh_material_count - m.first_material)
+			return damaged();
+
+		//the faces look their vertices and materials up without any checks, so the buffers have to agree with each other
+		auto faces = m.index_count / 3;
+		if (m.index_count % 3 != 0 || (m.normal_count != 0 && m.normal_count != m.position_count)
+			|| (m.uv_count != 0 && m.uv_count != 2 * m.position_count)
+			|| (m.face_material_count != 0 && m.face_material_count != faces) || (faces != 0 && m.material_count == 0))
+			return damaged();
+		auto indices = reinterpret_cast<const uint32_t*>(mesh_data + m.indices);
+		for (size_t k = 0; k < m.index_count; k++)
+			if (indices[k] >= m.position_count)
+				return damaged();
+		auto face_materials = reinterpret_cast<const uint16_t*>(mesh_data + m.face_materials);
+		for (size_t k = 0; k < m.face_material_count; k++)
+			if (face_materials[k] >= m.material_count)
+				return damaged();
+		for (uint32_t k = 0; k < m.material_count; k++)
+			if (mesh_materials[m.first_material + k] >= material_count)
+				return damaged();
+
+		auto mesh = make_shared<triangle_mesh>();
+		mesh->positions = buffer<point3>::view(reinterpret_cast<const point3*>(mesh_data + m.positions), m.position_count);
+		mesh->normals = buffer<vec3>::view(reinterpret_cast<const vec3*>(mesh_data + m.normals), m.normal_count);
+		mesh->uvs = buffer<float>::view(reinterpret_cast<const float*>(mesh_data + m.uvs), m.uv_count);
+		mesh->indices = buffer<uint32_t>::view(reinterpret_cast<const uint32_t*>(mesh_data + m.indices), m.index_count);
+		mesh->face_materials = buffer<uint16_t>::view(reinterpret_cast<const uint16_t*>(mesh_data + m.face_materials), m.face_material_count);
+		for (uint32_t k = 0; k < m.material_count; k++)
+			mesh->material_ids.push_back(scene_materials().add(material_table[mesh_materials[m.first_material + k]]));
+		mesh->source = dependency(m.source);
+
+		if (!prims.add_mesh(mesh))
+			return damaged();
+	}
+
+	for (size_t i = 0; i < ref_count; i++) {
+		auto index = primitive_store::ref_index(refs[i]);
+		switch (primitive_store::ref_type(refs[i])) {
+		case primitive_store::sphere_type:		if (index >= sphere_count) return damaged(); break;
+		case primitive_store::quad_type:		if (index >= quad_count) return damaged(); break;
+		case primitive_store::triangle_type:	if (index >= triangle_count) return damaged(); break;
+		case primitive_store::mesh_face_type:	if (index >= prims.mesh_face_total) return damaged(); break;
+		default:								return damaged();	//save() never writes anything else
+		}
+	}
+	prims.refs = buffer<uint32_t>::view(refs, ref_count);
+
+	bool nodes_ok = width == 8 ? nodes_intact(reinterpret_cast<const wide_bvh_node<8>*>(nodes), node_count, ref_count)
+		: width == 4 ? nodes_intact(reinterpret_cast<const wide_bvh_node<4>*>(nodes), node_count, ref_count)
+		: nodes_intact(reinterpret_cast<const linear_bvh_node*>(nodes), node_count, ref_count);
+	if (!nodes_ok)
+		return damaged();
+
+	aabb box(point3(h.box_min[0], h.box_min[1], h.box_min[2]), point3(h.box_max[0], h.box_max[1], h.box_max[2]));
+	switch (width) {
+	case 8:		return std::make_unique<wide_bvh<8>>(buffer<wide_bvh_node<8>>::view(reinterpret_cast<const wide_bvh_node<8>*>(nodes), node_count), std::move(prims), box);
+	case 4:		return std::make_unique<wide_bvh<4>>(buffer<wide_bvh_node<4>>::view(reinterpret_cast<const wide_bvh_node<4>*>(nodes), node_count), std::move(prims), box);
+	default:	return std::make_unique<linear_bvh>(buffer<linear_bvh_node>::view(reinterpret_cast<const linear_bvh_node*>(nodes), node_count), std::move(prims));
+	}
+}
+
+bool scene_cache::save(const hittable& bvh) {
+	using namespace cache_detail;
+
+	//the nodes and primitives of whichever bvh build_bvh picked
+	const primitive_store* prims = nullptr;
+	const char* node_data = nullptr;
+	size_t node_bytes = 0;
+	if (auto w8 = dynamic_cast<const wide_bvh<8>*>(&bvh)) {
+		prims = &w8->prims;
+		node_data = reinterpret_cast<const char*>(w8->nodes.data());
+		node_bytes = w8->nodes.size() * sizeof(wide_bvh_node<8>);
+	}
+	else if (auto w4 = dynamic_cast<const wide_bvh<4>*>(&bvh)) {
+		prims = &w4->prims;
+		node_data = reinterpret_cast<const char*>(w4->nodes.data());
+		node_bytes = w4->nodes.size() * sizeof(wide_bvh_node<4>);
+	}
+	else if (auto binary = dynamic_cast<const linear_bvh*>(&bvh)) {
+		prims = &binary->prims;
+		node_data = reinterpret_cast<const char*>(binary->nodes.data());
+		node_bytes = binary->nodes.size() * sizeof(linear_bvh_node);
+	}
+
+	if (!prims || !prims->others.empty() || !prims->instances.empty()) {
+		std::cerr << "Scene cache can't store this scene, it has instances or objects the cache doesn't know about.\n";
+		return false;
+	}
+
+	bool known = true;
+
+	std::vector<std::string> dependencies;
+	std::unordered_map<std::string, uint32_t> dependency_ids;
+	auto dependency = [&](const std::string& name) {
+		if (name.empty())
+			return none;
+		auto it = dependency_ids.find(name);
+		if (it != dependency_ids.end())
+			return it->second;
+		dependencies.push_back(name);
+		return dependency_ids[name] = static_cast<uint32_t>(dependencies.size() - 1);
+	};
+
+	std::vector<texture_record> textures;
+	std::vector<char> texels;
+	std::unordered_map<const texture*, uint32_t> texture_ids;
+	std::function<uint32_t(const shared_ptr<texture>&)> texture_id = [&](const shared_ptr<texture>& t) -> uint32_t {
+		auto it = texture_ids.find(t.get());
+		if (it != texture_ids.end())
+			return it->second;
+
+		texture_record r = {};
+		r.file = none;
+		r.texel_offset = UINT64_MAX;
+		if (auto solid = dynamic_cast<const solid_color*>(t.get())) {
+			r.type = texture_type::solid;
+			to_floats(solid->color_value, r.value);
+		}
+		else if (auto checker = dynamic_cast<const checker_texture*>(t.get())) {
+			r.type = texture_type::checker;
+			r.even = texture_id(checker->even);
+			r.odd = texture_id(checker->odd);
+		}
+		else if (auto image = dynamic_cast<const image_texture*>(t.get())) {
+			r.type = texture_type::image;
+			r.width = image->width;
+			r.height = image->height;
+			r.file = dependency(image->filename);
+			if (image->data)
+				r.texel_offset = append(texels, image->data, static_cast<size_t>(image->bytes_per_scanline) * image->height);
+		}
+		else if (auto grey = dynamic_cast<const greyscale*>(t.get())) {
+			r.type = texture_type::greyscale;
+			r.width = grey->width;
+			r.height = grey->height;
+			r.file = dependency(grey->filename);
+			if (grey->data)
+				r.texel_offset = append(texels, grey->data, static_cast<size_t>(grey->bytes_per_scanline) * grey->height);
+		}
+		else {
+			known = false;
+		}
+
+		textures.push_back(r);
+		return texture_ids[t.get()] = static_cast<uint32_t>(textures.size() - 1);
+	};
+
+	std::vector<material_record> materials;
+	std::unordered_map<const material*, uint32_t> material_ids;
+	auto material_id = [&](const shared_ptr<material>& m) -> uint32_t {
+		auto it = material_ids.find(m.get());
+		if (it != material_ids.end())
+			return it->second;
+
+		material_record r = {};
+		if (auto l = dynamic_cast<const lambertian*>(m.get())) {
+			r.type = material_type::lambertian;
+			r.albedo = texture_id(l->albedo);
+		}
+		else if (auto met = dynamic_cast<const metal*>(m.get())) {
+			r.type = material_type::metal;
+			r.albedo = texture_id(met->albedo);
+			r.second = texture_id(met->fuzz);
+		}
+		else if (auto d = dynamic_cast<const dielectric*>(m.get())) {
+			r.type = material_type::dielectric;
+			r.ir = d->ir;
+		}
+		else if (auto light = dynamic_cast<const diffuse_light*>(m.get())) {
+			r.type = material_type::diffuse_light;
+			r.albedo = texture_id(light->albedo);
+			r.second = texture_id(light->emit_map);
+		}
+		else {
+			known = false;
+		}
+
+		materials.push_back(r);
+		return material_ids[m.get()] = static_cast<uint32_t>(materials.size() - 1);
+	};
+
+	std::vector<sphere_record> spheres;
+	for (const auto& s : prims->spheres) {
+		sphere_record r;
+		to_floats(s.center, r.center);
+		r.radius = s.radius;
+		r.material = material_id(scene_materials().get(s.mat_id));
+		spheres.push_back(r);
+	}
+
+	std::vector<quad_record> quads;
+	for (const auto& q : prims->quads) {
+		quad_record r;
+		to_floats(q.q, r.q);
+		to_floats(q.u, r.u);
+		to_floats(q.v, r.v);
+		r.material = material_id(scene_materials().get(q.mat_id));
+		quads.push_back(r);
+	}
+
+	std::vector<triangle_record> triangles;
+	for (const auto& t : prims->triangles) {
+		triangle_record r;
+		to_floats(t.vertex0, r.v[0]);
+		to_floats(t.vertex1, r.v[1]);
+		to_floats(t.vertex2, r.v[2]);
+		r.material = material_id(scene_materials().get(t.mat_id));
+		triangles.push_back(r);
+	}
+
+	std::vector<mesh_record> meshes;
+	std::vector<char> mesh_data;
+	std::vector<uint32_t> mesh_materials;
+	for (const auto& shared_mesh : prims->meshes) {
+		const triangle_mesh* mesh = shared_mesh.get();
+		mesh_record r = {};
+		r.positions = append(mesh_data, mesh->positions.data(), r.position_count = mesh->positions.size());
+		r.normals = append(mesh_data, mesh->normals.data(), r.normal_count = mesh->normals.size());
+		r.uvs = append(mesh_data, mesh->uvs.data(), r.uv_count = mesh->uvs.size());
+		r.indices = append(mesh_data, mesh->indices.data(), r.index_count = mesh->indices.size());
+		r.face_materials = append(mesh_data, mesh->face_materials.data(), r.face_material_count = mesh->face_materials.size());
+		r.first_material = static_cast<uint32_t>(mesh_materials.size());
+		r.material_count = static_cast<uint32_t>(mesh->material_ids.size());
+		for (auto id : mesh->material_ids)
+			mesh_materials.push_back(material_id(scene_materials().get(id)));
+		r.source = dependency(mesh->source);
+		meshes.push_back(r);
+	}
+
+	if (!known) {
+		std::cerr << "Scene cache can't store this scene, it has materials or textures the cache doesn't know about.\n";
+		return false;
+	}
+
+	std::vector<char> dependency_data;
+	for (const auto& name : dependencies) {
+		auto d = stat_file(name);
+		d.name_length = static_cast<uint32_t>(name.size());
+		auto offset = dependency_data.size();
+		dependency_data.resize(offset + sizeof(d));
+		memcpy(dependency_data.data() + offset, &d, sizeof(d));
+		dependency_data.insert(dependency_data.end(), name.begin(), name.end());
+		pad_to(dependency_data, 8);
+	}
+
+	struct pending {
+		section_id id;
+		const void* data;
+		size_t size;
+	};
+	pending parts[] = {
+		{ dependencies_section, dependency_data.data(), dependency_data.size() },
+		{ textures_section, textures.data(), textures.size() * sizeof(texture_record) },
+		{ texels_section, texels.data(), texels.size() },
+		{ materials_section, materials.data(), materials.size() * sizeof(material_record) },
+		{ spheres_section, spheres.data(), spheres.size() * sizeof(sphere_record) },
+		{ quads_section, quads.data(), quads.size() * sizeof(quad_record) },
+		{ triangles_section, triangles.data(), triangles.size() * sizeof(triangle_record) },
+		{ meshes_section, meshes.data(), meshes.size() * sizeof(mesh_record) },
+		{ mesh_data_section, mesh_data.data(), mesh_data.size() },
+		{ mesh_materials_section, mesh_materials.data(), mesh_materials.size() * sizeof(uint32_t) },
+		{ refs_section, prims->refs.data(), prims->refs.size() * sizeof(uint32_t) },
+		{ nodes_section, node_data, node_bytes },
+	};
+	const uint32_t part_count = sizeof(parts) / sizeof(parts[0]);
+
+	header h = {};
+	memcpy(h.magic, "RTSCENE", 8);
+	h.version = scene_cache_version;
+	h.section_count = part_count;
+	h.key = key;
+	h.bvh_width = static_cast<uint32_t>(width);
+	aabb box;
+	bvh.bounding_box(0, 0, box);
+	to_floats(box.min(), h.box_min);
+	to_floats(box.max(), h.box_max);
+
+	std::vector<section> table(part_count);
+	uint64_t offset = sizeof(h) + part_count * sizeof(section);
+	for (uint32_t i = 0; i < part_count; i++) {
+		offset = (offset + alignment - 1) / alignment * alignment;
+		table[i] = { parts[i].id, 0, offset, parts[i].size };
+		offset += parts[i].size;
+	}
+
+	//written next to the real file and renamed at the end, a crash never leaves half a cache behind
+	auto temp = filename + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(section));
+		for (uint32_t i = 0; i < part_count; i++) {
+			static const char zeros[alignment] = {};
+			out.write(zeros, table[i].offset - static_cast<uint64_t>(out.tellp()));
+			if (parts[i].size)
+				out.write(static_cast<const char*>(parts[i].data), parts[i].size);
+		}
+		if (!out) {
+			std::cerr << "Could not write scene cache '" << temp << "'.\n";
+			return false;
+		}
+	}
+
+	//drop the old mapping first, windows won't replace a mapped file
+	file.reset();
+	std::error_code ec;
+	std::filesystem::rename(temp, filename, ec);
+	if (ec) {
+		std::cerr << "Could not write scene cache '" << filename << "'.\n";
+		return false;
+	}
+	return true;
+}
+
+#endif // !SCENE_CACHE_H
@@ -0,0 +1,78 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//a rectangle of pixels, x1 and y1 are exclusive
+struct tile {
+	int x0, y0;
+	int x1, y1;
+};
+
+//splits the image into small tiles and deals them out to one queue per worker.
+//a worker takes tiles from the front of its own queue and, once that runs dry,
+//steals from the back of the others, so whoever ends up with the expensive pixels gets help
+class tile_scheduler {
+public:
+	tile_scheduler(int imageWidth, int imageHeight, int workerCount, int tileSize = 16);
+
+	bool next(int worker, tile& out);
+	size_t tile_count() const { return total; }
+
+private:
+	struct tile_queue {
+		std::mutex lock;
+		std::deque<tile> tiles;
+	};
+
+	//mutexes can't be moved, hence the unique_ptr
+	std::vector<std::unique_ptr<tile_queue>> queues;
+	size_t total = 0;
+};
+
+tile_scheduler::tile_scheduler(int imageWidth, int imageHeight, int workerCount, int tileSize) {
+	workerCount = std::max(workerCount, 1);
+	for (int i = 0; i < workerCount; i++)
+		queues.push_back(std::make_unique<tile_queue>());
+
+	//tiles cover the whole image, the ones on the right and top edge are just smaller
+	std::vector<tile> tiles;
+	for (int y = 0; y < imageHeight; y += tileSize)
+		for (int x = 0; x < imageWidth; x += tileSize)
+			tiles.push_back({ x, y, std::min(x + tileSize, imageWidth), std::min(y + tileSize, imageHeight) });
+	total = tiles.size();
+
+	//hand out contiguous runs so each worker starts with neighbouring tiles, stealing evens out the rest
+	for (size_t i = 0; i < tiles.size(); i++)
+		queues[i * workerCount / tiles.size()]->tiles.push_back(tiles[i]);
+}
+
+bool tile_scheduler::next(int worker, tile& out) {
+	auto& own = *queues[worker];
+	{
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tiles.empty()) {
+			out = own.tiles.front();
+			own.tiles.pop_front();
+			return true;
+		}
+	}
+
+	//own queue is empty, steal from the far end of someone else's
+	for (size_t i = 1; i < queues.size(); i++) {
+		auto& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tiles.empty()) {
+			out = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif // !SCHEDULER_H
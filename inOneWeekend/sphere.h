@@ -1,21 +1,28 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include <algorithm>
+
 #include "hittable.h"
+#include "material_table.h"
 #include "vec3.h"
 
 class sphere : public hittable {
 public:
 	sphere() {}
-	sphere(point3 cen, float r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
+	sphere(point3 cen, float r, shared_ptr<material> m) : center(cen), radius(r), mat_id(scene_materials().add(m)) {};
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
 
+    //uniformly distributed point on the surface for s and t in [0, 1), used for sampling lights
+    void sample_surface(float s, float t, hit_record& rec) const;
+    float area() const { return 4 * pi * radius * radius; }
+
 public:
 	point3 center;
 	float radius;
-    shared_ptr<material> mat_ptr;
+    uint32_t mat_id;
 
 private:
     static void get_sphere_uv(const point3& p, float& u, float& v) {
@@ -51,11 +58,24 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     rec.normal = outward_normal;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_id = mat_id;
 
     return true;
 }
 
+void sphere::sample_surface(float s, float t, hit_record& rec) const {
+    auto z = 1 - 2 * s;
+    auto r = sqrt(std::max(0.0f, 1 - z * z));
+    auto phi = 2 * pi * t;
+    vec3 outward_normal(r * cos(phi), r * sin(phi), z);
+
+    rec.p = center + radius * outward_normal;
+    rec.normal = outward_normal;
+    rec.front_face = true;
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_id = mat_id;
+}
+
 bool sphere::bounding_box(float time0, float time1, aabb& output_box) const {
     output_box = aabb(
         center - vec3(radius, radius, radius),
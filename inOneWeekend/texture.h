@@ -1,6 +1,7 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <string>
 #include <vector>
 
 #include "color.h"
@@ -11,6 +12,28 @@ public:
 	virtual color value(float u, float v, const point3& p) const = 0;
 };
 
+//looks up the texel at u, v in 8 bit rgb or greyscale pixels, shared by the texture classes and the material table
+inline color texel_color(const unsigned char* data, int width, int height, int bytes_per_scanline, int bytes_per_pixel, float u, float v) {
+	if (data == nullptr) return color(0, 1, 1);
+
+	//clamp input texture coordinated to [0,1] x [1,0]
+	u = clamp(u, 0.0f, 1.0f);
+	v = 1.0f - clamp(v, 0.0f, 1.0f); //flip v to image coordinates
+
+	auto i = static_cast<int>(u * width);
+	auto j = static_cast<int>(v * height);
+
+	if (i >= width) i = width - 1;
+	if (j >= height) j = height - 1;
+
+	const auto color_scale = 1.0f / 255.0f;
+	auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
+
+	if (bytes_per_pixel == 1)
+		return color(color_scale * pixel[0], color_scale * pixel[0], color_scale * pixel[0]);
+	return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+}
+
 class solid_color :public texture {
 public:
 	solid_color(){}
@@ -22,7 +45,7 @@ public:
 	virtual color value(float u, float v, const vec3& p) const override {
 		return color_value;
 	}
-private:
+public:
 	color color_value;
 };
 
@@ -34,13 +57,16 @@ public:
 	checker_texture(color c1, color c2) : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
 	virtual color value(float u, float v, const point3& p) const override {
-		auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-		if (sines < 0)
+		if (is_odd(p))
 			return odd->value(u, v, p);
 		else
 			return even->value(u, v, p);
 	}
 
+	static bool is_odd(const point3& p) {
+		return sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z()) < 0;
+	}
+
 public:
 	shared_ptr<texture> odd;
 	shared_ptr<texture> even;
@@ -52,10 +78,11 @@ public:
 
 	image_texture() : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
 
-	image_texture(const char* filename) {
+	image_texture(const char* filename) : filename(filename) {
 		auto components_per_pixel = bytes_per_pixel;
 
 		data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
+		owns_data = data != nullptr;
 
 		if (!data) { std::cerr << "Could not load image file " << filename << "'.\n";
 		width = height = 0;
@@ -64,27 +91,17 @@ public:
 		bytes_per_scanline = bytes_per_pixel * width;
 	}
 
+	//already decoded texels someone else keeps alive, like the scene cache
+	image_texture(const unsigned char* pixels, int w, int h, const std::string& file)
+		: data(const_cast<unsigned char*>(pixels)), width(w), height(h), bytes_per_scanline(bytes_per_pixel * w), filename(file) {}
+
 	~image_texture() {
-		delete data;
+		if (owns_data)
+			stbi_image_free(data);
 	}
 
 	virtual color value(float u, float v, const vec3& p) const override {
-		if (data == nullptr) return color(0, 1, 1);
-
-		//clamp input texture coordinated to [0,1] x [1,0]
-		u = clamp(u, 0.0, 1.0);
-		v = 1.0 - clamp(v, 0.0, 1.0); //flip v to image coordinates
-
-		auto i = static_cast<int>(u * width);
-		auto j = static_cast<int>(v * height);
-
-		if (i >= width) i = width - 1;
-		if (j >= height) j = height - 1;
-
-		const auto color_scale = 1.0 / 255.0;
-		auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
-
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+		return texel_color(data, width, height, bytes_per_scanline, bytes_per_pixel, u, v);
 	}
 
 public:
@@ -92,6 +109,8 @@ public:
 	int width;
 	int height;
 	int bytes_per_scanline;
+	std::string filename;
+	bool owns_data = false;
 };
 
 class greyscale : public texture {
@@ -100,10 +119,11 @@ public:
 
 	greyscale() : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
 
-	greyscale(const char* filename) {
+	greyscale(const char* filename) : filename(filename) {
 		auto components_per_pixel = bytes_per_pixel;
 
 		data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
+		owns_data = data != nullptr;
 
 		if (!data) {
 			std::cerr << "Could not load image file " << filename << "'.\n";
@@ -113,27 +133,17 @@ public:
 		bytes_per_scanline = width;
 	}
 
+	//already decoded texels someone else keeps alive, like the scene cache
+	greyscale(const unsigned char* pixels, int w, int h, const std::string& file)
+		: data(const_cast<unsigned char*>(pixels)), width(w), height(h), bytes_per_scanline(w), filename(file) {}
+
 	~greyscale() {
-		delete data;
+		if (owns_data)
+			stbi_image_free(data);
 	}
 
 	virtual color value(float u, float v, const vec3& p) const override {
-		if (data == nullptr) return color(0, 1, 1);
-
-		//clamp input texture coordinated to [0,1] x [1,0]
-		u = clamp(u, 0.0, 1.0);
-		v = 1.0 - clamp(v, 0.0, 1.0); //flip v to image coordinates
-
-		auto i = static_cast<int>(u * width);
-		auto j = static_cast<int>(v * height);
-
-		if (i >= width) i = width - 1;
-		if (j >= height) j = height - 1;
-
-		const auto color_scale = 1.0 / 255.0;
-		auto pixel = data + j * bytes_per_scanline + i;
-
-		return color(color_scale * pixel[0], color_scale * pixel[0], color_scale * pixel[0]);
+		return texel_color(data, width, height, bytes_per_scanline, bytes_per_pixel, u, v);
 	}
 
 public:
@@ -141,6 +151,8 @@ public:
 	int width;
 	int height;
 	int bytes_per_scanline;
+	std::string filename;
+	bool owns_data = false;
 };
 
 #endif // !TEXTURE_H
@@ -3,24 +3,30 @@
 
 #include "common.h"
 #include "hittable.h"
+#include "material_table.h"
 #include "vec3.h"
 
 class triangle : public hittable {
 public:
 	triangle() {}
-	triangle(point3 a, point3 b, point3 c, shared_ptr<material> m) : vertex0(a), vertex1(b), vertex2(c), mat_ptr(m) {};
+	triangle(point3 a, point3 b, point3 c, shared_ptr<material> m) : vertex0(a), vertex1(b), vertex2(c), mat_id(scene_materials().add(m)) {};
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
 
+	//uniformly distributed point on the triangle for s and t in [0, 1), used for sampling lights
+	void sample_surface(float s, float t, hit_record& rec) const;
+	float area() const { return outward_normal.length() / 2; }
+
 public:
 	point3 vertex0;
 	point3 vertex1;
 	point3 vertex2;
 	vec3 edge0 = vertex1 - vertex0;
 	vec3 edge1 = vertex2 - vertex0;
-	shared_ptr<material> mat_ptr;
+	uint32_t mat_id;
 	vec3 outward_normal = cross(edge0, edge1);
+	vec3 normal = unit_vector(outward_normal);
 };
 
 //implementation of Mller-Trumbore intersection algorithm
@@ -34,7 +40,7 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	if (dot(r.dir, outward_normal) > 0)
 		return false; //Ray intersects with backside of triangle
 
-	auto f = 1.0 / a;
+	auto f = 1.0f / a;
 	auto s = r.origin() - vertex0;
 	auto u = f * dot(s, h);
 	if (u < 0.0 || u > 1.0)
@@ -55,12 +61,23 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	rec.p = at;
 	rec.u = u;
 	rec.v = v;
-	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mat_ptr;
+	rec.set_face_normal(r, normal);
+	rec.mat_id = mat_id;
 
 	return true;
 }
 
+void triangle::sample_surface(float s, float t, hit_record& rec) const {
+	//folding the square onto the triangle with a square root keeps the density even
+	auto root = sqrt(s);
+	rec.u = 1 - root;
+	rec.v = t * root;
+	rec.p = vertex0 + rec.u * edge0 + rec.v * edge1;
+	rec.normal = normal;
+	rec.front_face = true;
+	rec.mat_id = mat_id;
+}
+
 bool triangle::bounding_box(float time0, float time1, aabb& output_box) const {
 	float min_x = fmin(vertex0.x(), fmin(vertex1.x(), vertex2.x()));
 	float min_y = fmin(vertex0.y(), fmin(vertex1.y(), vertex2.y()));
@@ -70,7 +87,7 @@ bool triangle::bounding_box(float time0, float time1, aabb& output_box) const {
 	float max_y = fmax(vertex0.y(), fmax(vertex1.y(), vertex2.y()));
 	float max_z = fmax(vertex0.z(), fmax(vertex1.z(), vertex2.z()));
 
-	output_box = aabb(point3(min_x, min_y, min_z), point3(max_x, max_y, max_z));
+	output_box = aabb(point3(min_x, min_y, min_z), point3(max_x, max_y, max_z)).padded();
 
 	return true;
 }
@@ -0,0 +1,164 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "common.h"
+#include "hittable.h"
+#include "material_table.h"
+#include "vec3.h"
+
+//lots of triangles sharing one set of vertex buffers instead of one heap object per triangle.
+//a face is three indices into positions (and normals/uvs if there are any) plus an optional material index,
+//which comes down to about 20 bytes per triangle for a typical closed mesh
+class triangle_mesh : public hittable {
+public:
+	triangle_mesh() {}
+	triangle_mesh(std::vector<point3> p, std::vector<uint32_t> i, shared_ptr<material> m)
+		: positions(std::move(p)), indices(std::move(i)), material_ids{ scene_materials().add(m) } {}
+
+	size_t face_count() const { return indices.size() / 3; }
+
+	bool hit_face(size_t face, const ray& r, float t_min, float t_max, hit_record& rec) const;
+	aabb face_box(size_t face) const;
+	uint32_t face_material(size_t face) const { return material_ids[face_materials.empty() ? 0 : face_materials[face]]; }
+
+	//same as triangle::sample_surface, for sampling lights
+	void sample_face(size_t face, float s, float t, hit_record& rec) const;
+	float face_area(size_t face) const;
+
+	//only used when the mesh isn't part of a linear_bvh, that one takes the faces apart
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+public:
+	buffer<point3> positions;
+	buffer<uint32_t> indices;			//3 per face
+	buffer<vec3> normals;				//optional, one per position
+	buffer<float> uvs;					//optional, u and v per position
+	buffer<uint16_t> face_materials;	//optional, index into material_ids per face
+	std::vector<uint32_t> material_ids;	//ids in scene_materials()
+
+	//the file the mesh was loaded from, if any
+	std::string source;
+};
+
+//same Moller-Trumbore test and backface culling as triangle, vertices are looked up on the fly
+inline bool triangle_mesh::hit_face(size_t face, const ray& r, float t_min, float t_max, hit_record& rec) const {
+	auto i0 = indices[3 * face], i1 = indices[3 * face + 1], i2 = indices[3 * face + 2];
+	const auto& vertex0 = positions[i0];
+	auto edge0 = positions[i1] - vertex0;
+	auto edge1 = positions[i2] - vertex0;
+
+	auto h = cross(r.direction(), edge1);
+	auto a = dot(edge0, h);
+
+	if (a > -1e-8f && a < 1e-8f)
+		return false; //Ray is parallel to triangle
+
+	auto outward_normal = cross(edge0, edge1);
+	if (dot(r.dir, outward_normal) > 0)
+		return false; //Ray intersects with backside of triangle
+
+	auto f = 1.0f / a;
+	auto s = r.origin() - vertex0;
+	auto u = f * dot(s, h);
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	auto q = cross(s, edge0);
+	auto v = f * dot(r.direction(), q);
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	auto t = f * dot(edge1, q);
+	if (t < t_min || t_max < t)
+		return false;
+
+	rec.t = t;
+	rec.p = r.at(t);
+	rec.set_face_normal(r, unit_vector(outward_normal));
+
+	auto w = 1 - u - v;
+	if (!normals.empty()) {
+		//smooth shading, flipped the same way as the geometric normal
+		auto shading = unit_vector(w * normals[i0] + u * normals[i1] + v * normals[i2]);
+		rec.normal = rec.front_face ? shading : -shading;
+	}
+
+	if (!uvs.empty()) {
+		rec.u = w * uvs[2 * i0] + u * uvs[2 * i1] + v * uvs[2 * i2];
+		rec.v = w * uvs[2 * i0 + 1] + u * uvs[2 * i1 + 1] + v * uvs[2 * i2 + 1];
+	}
+	else {
+		rec.u = u;
+		rec.v = v;
+	}
+
+	rec.mat_id = face_material(face);
+	return true;
+}
+
+void triangle_mesh::sample_face(size_t face, float s, float t, hit_record& rec) const {
+	auto i0 = indices[3 * face], i1 = indices[3 * face + 1], i2 = indices[3 * face + 2];
+	const auto& vertex0 = positions[i0];
+	auto edge0 = positions[i1] - vertex0;
+	auto edge1 = positions[i2] - vertex0;
+
+	auto root = sqrt(s);
+	auto u = 1 - root;
+	auto v = t * root;
+	auto w = 1 - u - v;
+
+	rec.p = vertex0 + u * edge0 + v * edge1;
+	rec.normal = unit_vector(cross(edge0, edge1));
+	rec.front_face = true;
+	if (!uvs.empty()) {
+		rec.u = w * uvs[2 * i0] + u * uvs[2 * i1] + v * uvs[2 * i2];
+		rec.v = w * uvs[2 * i0 + 1] + u * uvs[2 * i1 + 1] + v * uvs[2 * i2 + 1];
+	}
+	else {
+		rec.u = u;
+		rec.v = v;
+	}
+	rec.mat_id = face_material(face);
+}
+
+float triangle_mesh::face_area(size_t face) const {
+	const auto& a = positions[indices[3 * face]];
+	return cross(positions[indices[3 * face + 1]] - a, positions[indices[3 * face + 2]] - a).length() / 2;
+}
+
+aabb triangle_mesh::face_box(size_t face) const {
+	const auto& a = positions[indices[3 * face]];
+	const auto& b = positions[indices[3 * face + 1]];
+	const auto& c = positions[indices[3 * face + 2]];
+	return surrounding_box(aabb(a, b), aabb(c, c)).padded();
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	bool hit_anything = false;
+	for (size_t face = 0; face < face_count(); face++) {
+		if (hit_face(face, r, t_min, t_max, rec)) {
+			hit_anything = true;
+			t_max = rec.t;
+		}
+	}
+	return hit_anything;
+}
+
+bool triangle_mesh::bounding_box(float time0, float time1, aabb& output_box) const {
+	if (positions.empty())
+		return false;
+
+	aabb box(positions[0], positions[0]);
+	for (const auto& p : positions)
+		box = surrounding_box(box, aabb(p, p));
+	output_box = box.padded();
+	return true;
+}
+
+#endif // !TRIANGLE_MESH_H
@@ -1,6 +1,7 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
@@ -8,7 +9,20 @@
 
 using std::sqrt;
 
-class vec3 {
+//1 stores vec3 as 4 floats in one sse register, the arithmetic below is then one instruction instead of three.
+//every vec3 gets 4 bytes bigger and unit_vector uses the approximate reciprocal square root
+#ifndef RT_SIMD_VEC3
+#define RT_SIMD_VEC3 0
+#endif
+
+#if RT_SIMD_VEC3 && defined(RT_HAS_SSE)
+#define RT_VEC3_SSE 1
+#define RT_VEC3_ALIGN alignas(16)
+#else
+#define RT_VEC3_ALIGN
+#endif
+
+class RT_VEC3_ALIGN vec3 {
 public:
     vec3() : e{ 0,0,0 } {}
     vec3(float e0, float e1, float e2) : e{ e0, e1, e2 } {}
@@ -17,9 +31,23 @@ public:
     float y() const { return e[1]; }
     float z() const { return e[2]; }
 
+#ifdef RT_VEC3_SSE
+    explicit vec3(__m128 v) { _mm_store_ps(e, v); }
+    __m128 simd() const { return _mm_load_ps(e); }
+
+    vec3 operator-() const { return vec3(_mm_xor_ps(simd(), _mm_set1_ps(-0.0f))); }
+
+    vec3& operator+=(const vec3& v) {
+        _mm_store_ps(e, _mm_add_ps(simd(), v.simd()));
+        return *this;
+    }
+
+    vec3& operator*=(const float t) {
+        _mm_store_ps(e, _mm_mul_ps(simd(), _mm_set1_ps(t)));
+        return *this;
+    }
+#else
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    float operator[](int i) const { return e[i]; }
-    float& operator[](int i) { return e[i]; }
 
     vec3& operator+=(const vec3& v) {
         e[0] += v.e[0];
@@ -34,6 +62,10 @@ public:
         e[2] *= t;
         return *this;
     }
+#endif
+
+    float operator[](int i) const { return e[i]; }
+    float& operator[](int i) { return e[i]; }
 
     vec3& operator/=(const float t) {
         return *this *= 1 / t;
@@ -59,12 +91,16 @@ public:
     }
 
     bool near_zero() const {
-        const auto s = 1e-8;
-        return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+        const auto s = 1e-8f;
+        return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
 
 public:
+#ifdef RT_VEC3_SSE
+    float e[4];     //the last one is padding and stays 0
+#else
     float e[3];
+#endif
 };
 
 //aliases for vec3
@@ -77,6 +113,23 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#ifdef RT_VEC3_SSE
+inline vec3 operator+(const vec3& u, const vec3& v) {
+    return vec3(_mm_add_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator-(const vec3& u, const vec3& v) {
+    return vec3(_mm_sub_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator*(const vec3& u, const vec3& v) {
+    return vec3(_mm_mul_ps(u.simd(), v.simd()));
+}
+
+inline vec3 operator*(float t, const vec3& v) {
+    return vec3(_mm_mul_ps(_mm_set1_ps(t), v.simd()));
+}
+#else
 inline vec3 operator+(const vec3& u, const vec3& v) {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
@@ -92,6 +145,7 @@ inline vec3 operator*(const vec3& u, const vec3& v) {
 inline vec3 operator*(float t, const vec3& v) {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
+#endif
 
 inline vec3 operator*(const vec3& v, float t) {
     return t * v;
@@ -101,6 +155,33 @@ inline vec3 operator/(vec3 v, float t) {
     return (1 / t) * v;
 }
 
+#ifdef RT_VEC3_SSE
+//adds up x, y and z in the same order as the scalar version, so both give the same result
+inline float dot(const vec3& u, const vec3& v) {
+    auto m = _mm_mul_ps(u.simd(), v.simd());
+    auto y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+    auto z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, y), z));
+}
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    auto a = u.simd();
+    auto b = v.simd();
+    auto a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    auto b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    auto c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return vec3(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+//approximate 1 / length plus one newton step, close to float precision without a division or a square root
+inline vec3 unit_vector(vec3 v) {
+    auto length_squared = _mm_set_ss(dot(v, v));
+    auto r = _mm_rsqrt_ss(length_squared);
+    auto half_x = _mm_mul_ss(_mm_set_ss(0.5f), length_squared);
+    r = _mm_mul_ss(r, _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(half_x, _mm_mul_ss(r, r))));
+    return vec3(_mm_mul_ps(v.simd(), _mm_shuffle_ps(r, r, 0)));
+}
+#else
 inline float dot(const vec3& u, const vec3& v) {
     return u.e[0] * v.e[0]
         + u.e[1] * v.e[1]
@@ -116,11 +197,13 @@ inline vec3 cross(const vec3& u, const vec3& v) {
 inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
+#endif
 
+//everything in float, fmin and fabs with a double would send the whole thing through double math
 vec3 refract(const vec3& uv, const vec3& n, const float etaiOverEtat) {
-    auto cosTheta = fmin(dot(-uv, n), 1.0);
+    auto cosTheta = std::min(dot(-uv, n), 1.0f);
     vec3 rOutPerp = etaiOverEtat * (uv + cosTheta * n);
-    vec3 rOutParallel = -sqrt(fabs(1.0 - rOutPerp.length_squared())) * n;
+    vec3 rOutParallel = -sqrt(std::fabs(1.0f - rOutPerp.length_squared())) * n;
     return rOutPerp + rOutParallel;
 }
 
@@ -148,11 +231,35 @@ vec3 random_in_hemisphere(const vec3& normal) {
         return -in_unit_sphere;
 }
 
+//direction around the z axis with a density of cos(theta) / pi, two random numbers and no rejection loop.
+//turn it into world space with an onb around the normal
+vec3 random_cosine_direction() {
+    float r1, r2;
+    random_float2(r1, r2);
+    auto phi = 2 * pi * r1;
+    auto r = sqrt(r2);
+    return vec3(cos(phi) * r, sin(phi) * r, sqrt(1 - r2));
+}
+
+//concentric mapping (Shirley and Chiu 1997) of the unit square onto the disk, no rejection loop
+//and points that are evenly spread on the square stay evenly spread on the disk
 vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_float(-1, 1), random_float(-1, 1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
+    float a, b;
+    random_float2(a, b);
+    a = 2 * a - 1;
+    b = 2 * b - 1;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+
+    float r, theta;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    }
+    else {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
     }
+    return vec3(r * cos(theta), r * sin(theta), 0);
 }
 #endif
\ No newline at end of file
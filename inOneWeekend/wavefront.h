@@ -0,0 +1,193 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material_table.h"
+#include "sampler.h"
+
+//a batch of paths traced together one stage at a time instead of one path start to finish:
+//every active path gets intersected, then the hits get sorted by material and shaded, then the shadow rays
+//that shading asked for get traced, and round it goes with the paths that are still alive.
+//every stage runs the same code over many paths in a row, and paths on the same material use the same textures back to back.
+//the state of each path lives in arrays (one per field) indexed by path, only active and the queues get reshuffled.
+//every path keeps its own sampler, so it draws the same random numbers in the same order as rayColor would
+class path_wave {
+public:
+	//empties the wave, the memory stays for the next one
+	void clear() {
+		rays.clear();
+		throughput.clear();
+		radiance.clear();
+		bounce_pdf.clear();
+		hits.clear();
+	}
+
+	size_t size() const { return rays.size(); }
+
+	//adds a path for pixel sample (x, y, sample) and makes its sampler the current one,
+	//the camera ray drawn right after becomes rays[returned index]
+	size_t add_path(uint32_t x, uint32_t y, uint32_t sample) {
+		auto i = rays.size();
+		if (samplers.size() == i || type != render_sampler()) {
+			if (type != render_sampler())
+				samplers.clear();
+			type = render_sampler();
+			while (samplers.size() <= i)
+				samplers.push_back(make_sampler(type));
+		}
+
+		rays.emplace_back();
+		throughput.emplace_back(1, 1, 1);
+		radiance.emplace_back(0, 0, 0);
+		bounce_pdf.push_back(0);
+		hits.emplace_back();
+
+		samplers[i]->start(x, y, sample);
+		current_sampler() = samplers[i].get();
+		return i;
+	}
+
+	//follows every path until it leaves the scene, gets absorbed or runs out of bounces, radiance holds the result.
+	//MaxBounces and LightSampling mean the same as for rayColor
+	template <int MaxBounces, bool LightSampling>
+	void trace(const color& background, const hittable& world, const light_list& lights, int bounces);
+
+public:
+	std::vector<ray> rays;			//the next ray of every path
+	std::vector<color> throughput;
+	std::vector<color> radiance;
+	std::vector<float> bounce_pdf;
+	std::vector<hit_record> hits;
+
+private:
+	void sort_by_material();
+
+	sampler_type type = sampler_type::independent;
+	std::vector<std::unique_ptr<sampler>> samplers;
+
+	//paths still going, the ones that hit something, and the same sorted by material
+	std::vector<uint32_t> active;
+	std::vector<uint32_t> hit;
+	std::vector<uint32_t> sorted;
+	std::vector<uint32_t> material_start;
+
+	//shadow rays shading asked for, light only gets added to the path if nothing is in the way
+	std::vector<ray> shadow_rays;
+	std::vector<float> shadow_max_t;
+	std::vector<color> shadow_light;
+	std::vector<uint32_t> shadow_path;
+};
+
+template <int MaxBounces, bool LightSampling>
+void path_wave::trace(const color& background, const hittable& world, const light_list& lights, int bounces) {
+	if (MaxBounces > 0)
+		bounces = MaxBounces;
+
+	//same as in rayColor
+	const int roulette_start = 3;
+
+	active.resize(size());
+	for (size_t i = 0; i < active.size(); i++)
+		active[i] = static_cast<uint32_t>(i);
+
+	for (int depth = 0; depth < bounces && !active.empty(); depth++) {
+		//intersect, the paths that leave the scene are done
+		hit.clear();
+		for (auto i : active) {
+			if (world.hit(rays[i], 0.001, infinity, hits[i]))
+				hit.push_back(i);
+			else
+				radiance[i] = radiance[i] + throughput[i] * background;
+		}
+
+		sort_by_material();
+
+		//shade
+		active.clear();
+		shadow_rays.clear();
+		shadow_max_t.clear();
+		shadow_light.clear();
+		shadow_path.clear();
+		for (auto i : sorted) {
+			current_sampler() = samplers[i].get();
+			const auto& rec = hits[i];
+			const auto& current = rays[i];
+
+			ray scattered;
+			color attenuation;
+			color emitted;
+
+			const auto& mat = scene_materials()[rec.mat_id];
+			if (mat.emitted(current, rec, attenuation, scattered, emitted)) {
+				float weight = 1;
+				if (LightSampling && bounce_pdf[i] > 0) {
+					auto distance_squared = rec.t * rec.t * current.direction().length_squared();
+					auto light_cosine = fabs(dot(unit_vector(current.direction()), rec.normal));
+					weight = power_heuristic(bounce_pdf[i], lights.pdf(distance_squared, light_cosine));
+				}
+				radiance[i] = radiance[i] + weight * throughput[i] * emitted;
+				continue;
+			}
+
+			bool sample_lights = LightSampling && !mat.is_specular(rec) && depth + 1 < bounces;
+			if (sample_lights) {
+				ray shadow;
+				float max_t;
+				color contribution;
+				if (light_connection(current, rec, mat, lights, shadow, max_t, contribution)) {
+					shadow_rays.push_back(shadow);
+					shadow_max_t.push_back(max_t);
+					shadow_light.push_back(throughput[i] * contribution);
+					shadow_path.push_back(i);
+				}
+			}
+
+			if (!mat.scatter(current, rec, attenuation, scattered))
+				continue;
+			throughput[i] = throughput[i] * attenuation;
+			bounce_pdf[i] = sample_lights ? mat.pdf(current, rec, unit_vector(scattered.direction())) : 0;
+
+			if (depth >= roulette_start) {
+				auto survival = std::min(std::max(throughput[i].x(), std::max(throughput[i].y(), throughput[i].z())), 0.95f);
+				if (random_float() >= survival)
+					continue;
+				throughput[i] /= survival;
+			}
+
+			rays[i] = scattered;
+			active.push_back(i);
+		}
+
+		//shadow rays, each one only adds to its own path so the order doesn't matter
+		for (size_t k = 0; k < shadow_rays.size(); k++) {
+			hit_record blocker;
+			if (!world.hit(shadow_rays[k], 0.001, shadow_max_t[k], blocker))
+				radiance[shadow_path[k]] += shadow_light[k];
+		}
+
+		//the next round goes in path order again, neighbouring pixels tend to hit the same parts of the bvh
+		std::sort(active.begin(), active.end());
+	}
+}
+
+//counting sort on the material id, paths keep their order within a material
+inline void path_wave::sort_by_material() {
+	material_start.assign(scene_materials().size() + 1, 0);
+	for (auto i : hit)
+		material_start[hits[i].mat_id + 1]++;
+	for (size_t m = 1; m < material_start.size(); m++)
+		material_start[m] += material_start[m - 1];
+
+	sorted.resize(hit.size());
+	for (auto i : hit)
+		sorted[material_start[hits[i].mat_id]++] = i;
+}
+
+#endif // !WAVEFRONT_H
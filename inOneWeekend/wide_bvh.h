@@ -0,0 +1,501 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+//0 picks the width at runtime from what the cpu supports, 2, 4 or 8 forces a width
+#ifndef RT_BVH_WIDTH
+#define RT_BVH_WIDTH 0
+#endif
+
+//gcc and clang only emit avx instructions in functions that ask for them, msvc always does
+#if defined(RT_HAS_SSE) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RT_TARGET_AVX2
+#endif
+
+inline bool cpu_has_avx2() {
+#if defined(RT_HAS_SSE) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+	__cpuidex(info, 7, 0);
+	bool avx2 = info[1] & (1 << 5);
+
+	//the os also has to save the upper halves of the registers on a context switch
+	return os_saves_ymm && avx2 && (_xgetbv(0) & 6) == 6;
+#elif defined(RT_HAS_SSE)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+//N children per node with their boxes stored lane by lane (bmin[axis][child]),
+//so one ray gets tested against all of them with a handful of simd instructions
+template <int N>
+struct alignas(32) wide_bvh_node {
+	float bmin[3][N];
+	float bmax[3][N];
+	uint32_t child[N];	//leaf: first primitive, otherwise: index of the child node
+	uint16_t count[N];	//number of primitives, 0 for child nodes
+	uint8_t children;	//lanes in use, the empty ones are at the end
+};
+
+//ray data broadcast into simd lanes once per ray, the loop only multiplies and compares
+struct wide_ray {
+	float origin[3];
+	float inv_dir[3];
+};
+
+//tests all children of a node at once, writes the entry distances and returns one bit per child that got hit
+template <int N>
+inline uint32_t hit_wide_node(const wide_bvh_node<N>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+	uint32_t mask = 0;
+	for (int i = 0; i < node.children; i++) {
+		auto lo = t_min;
+		auto hi = t_max;
+		for (int a = 0; a < 3; a++) {
+			auto t0 = (node.bmin[a][i] - r.origin[a]) * r.inv_dir[a];
+			auto t1 = (node.bmax[a][i] - r.origin[a]) * r.inv_dir[a];
+			auto t_enter = t0 < t1 ? t0 : t1;
+			auto t_exit = t0 < t1 ? t1 : t0;
+			lo = t_enter > lo ? t_enter : lo;
+			hi = t_exit < hi ? t_exit : hi;
+		}
+		t_near[i] = lo;
+		if (lo <= hi)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+#ifdef RT_HAS_SSE
+template <>
+inline uint32_t hit_wide_node<4>(const wide_bvh_node<4>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+	auto lo = _mm_set1_ps(t_min);
+	auto hi = _mm_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		auto o = _mm_set1_ps(r.origin[a]);
+		auto inv = _mm_set1_ps(r.inv_dir[a]);
+		auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bmin[a]), o), inv);
+		auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bmax[a]), o), inv);
+		lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+		hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+	}
+	_mm_storeu_ps(t_near, lo);
+	return _mm_movemask_ps(_mm_cmple_ps(lo, hi)) & ((1u << node.children) - 1);
+}
+
+template <>
+RT_TARGET_AVX2 inline uint32_t hit_wide_node<8>(const wide_bvh_node<8>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+	auto lo = _mm256_set1_ps(t_min);
+	auto hi = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		auto o = _mm256_set1_ps(r.origin[a]);
+		auto inv = _mm256_set1_ps(r.inv_dir[a]);
+		auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bmin[a]), o), inv);
+		auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bmax[a]), o), inv);
+		lo = _mm256_max_ps(lo, _mm256_min_ps(t0, t1));
+		hi = _mm256_min_ps(hi, _mm256_max_ps(t0, t1));
+	}
+	_mm256_storeu_ps(t_near, lo);
+	return _mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)) & ((1u << node.children) - 1);
+}
+#endif
+
+//a packet of rays from the same origin, boxed in by the smallest and largest inverse direction per axis.
+//only works if every ray goes the same way along every axis, then a box none of the rays can hit is thrown out with one test.
+//rounding can't get in the way: (b - o) * inv moves the same way inv does, so the bounds below hold for every single ray
+struct packet_frustum {
+	float origin[3];
+	float inv_lo[3];
+	float inv_hi[3];
+	bool positive[3];	//which way the rays go along each axis, picks the near and far side of a box
+
+	//false if the rays start at different points or spread to both sides of an axis
+	bool build(const ray_packet& packet) {
+		for (int a = 0; a < 3; a++) {
+			origin[a] = packet.rays[0].origin()[a];
+			positive[a] = packet.rays[0].direction()[a] > 0;
+			inv_lo[a] = infinity;
+			inv_hi[a] = -infinity;
+		}
+		for (int i = 0; i < packet.size; i++) {
+			for (int a = 0; a < 3; a++) {
+				auto d = packet.rays[i].direction()[a];
+				auto inv = 1 / d;
+				if (packet.rays[i].origin()[a] != origin[a] || (d > 0) != positive[a] || d == 0 || !std::isfinite(inv))
+					return false;
+				inv_lo[a] = std::min(inv_lo[a], inv);
+				inv_hi[a] = std::max(inv_hi[a], inv);
+			}
+		}
+		return true;
+	}
+};
+
+//hit_wide_node for the whole packet: one bit per child at least one of its rays might hit.
+//t_near gets the closest any of them could enter the child
+template <int N>
+inline uint32_t hit_wide_node(const wide_bvh_node<N>& node, const packet_frustum& f, float t_min, float t_max, float* t_near) {
+	uint32_t mask = 0;
+	for (int i = 0; i < node.children; i++) {
+		auto lo = t_min;
+		auto hi = t_max;
+		for (int a = 0; a < 3; a++) {
+			auto d_near = (f.positive[a] ? node.bmin[a][i] : node.bmax[a][i]) - f.origin[a];
+			auto d_far = (f.positive[a] ? node.bmax[a][i] : node.bmin[a][i]) - f.origin[a];
+			auto t_enter = std::min(d_near * f.inv_lo[a], d_near * f.inv_hi[a]);
+			auto t_exit = std::max(d_far * f.inv_lo[a], d_far * f.inv_hi[a]);
+			lo = t_enter > lo ? t_enter : lo;
+			hi = t_exit < hi ? t_exit : hi;
+		}
+		t_near[i] = lo;
+		if (lo <= hi)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+#ifdef RT_HAS_SSE
+template <>
+inline uint32_t hit_wide_node<4>(const wide_bvh_node<4>& node, const packet_frustum& f, float t_min, float t_max, float* t_near) {
+	auto lo = _mm_set1_ps(t_min);
+	auto hi = _mm_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		auto o = _mm_set1_ps(f.origin[a]);
+		auto inv_lo = _mm_set1_ps(f.inv_lo[a]);
+		auto inv_hi = _mm_set1_ps(f.inv_hi[a]);
+		auto d_near = _mm_sub_ps(_mm_loadu_ps(f.positive[a] ? node.bmin[a] : node.bmax[a]), o);
+		auto d_far = _mm_sub_ps(_mm_loadu_ps(f.positive[a] ? node.bmax[a] : node.bmin[a]), o);
+		lo = _mm_max_ps(lo, _mm_min_ps(_mm_mul_ps(d_near, inv_lo), _mm_mul_ps(d_near, inv_hi)));
+		hi = _mm_min_ps(hi, _mm_max_ps(_mm_mul_ps(d_far, inv_lo), _mm_mul_ps(d_far, inv_hi)));
+	}
+	_mm_storeu_ps(t_near, lo);
+	return _mm_movemask_ps(_mm_cmple_ps(lo, hi)) & ((1u << node.children) - 1);
+}
+
+template <>
+RT_TARGET_AVX2 inline uint32_t hit_wide_node<8>(const wide_bvh_node<8>& node, const packet_frustum& f, float t_min, float t_max, float* t_near) {
+	auto lo = _mm256_set1_ps(t_min);
+	auto hi = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		auto o = _mm256_set1_ps(f.origin[a]);
+		auto inv_lo = _mm256_set1_ps(f.inv_lo[a]);
+		auto inv_hi = _mm256_set1_ps(f.inv_hi[a]);
+		auto d_near = _mm256_sub_ps(_mm256_loadu_ps(f.positive[a] ? node.bmin[a] : node.bmax[a]), o);
+		auto d_far = _mm256_sub_ps(_mm256_loadu_ps(f.positive[a] ? node.bmax[a] : node.bmin[a]), o);
+		lo = _mm256_max_ps(lo, _mm256_min_ps(_mm256_mul_ps(d_near, inv_lo), _mm256_mul_ps(d_near, inv_hi)));
+		hi = _mm256_min_ps(hi, _mm256_max_ps(_mm256_mul_ps(d_far, inv_lo), _mm256_mul_ps(d_far, inv_hi)));
+	}
+	_mm256_storeu_ps(t_near, lo);
+	return _mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)) & ((1u << node.children) - 1);
+}
+#endif
+
+//the binary linear_bvh collapsed into nodes with up to N children.
+//fewer levels, and each level is a single simd box test instead of N scalar ones
+template <int N>
+class wide_bvh : public hittable {
+public:
+	wide_bvh() {}
+	wide_bvh(const hittable_list& list);
+	//an already built bvh, e.g. one straight out of the scene cache
+	wide_bvh(buffer<wide_bvh_node<N>> n, primitive_store p, const aabb& b) : nodes(std::move(n)), prims(std::move(p)), box(b) {}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+	virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+	virtual void hit_packet(ray_packet& packet, float t_min) const override;
+
+public:
+	buffer<wide_bvh_node<N>> nodes;
+	primitive_store prims;
+	aabb box;
+
+private:
+	uint32_t collapse(const buffer<linear_bvh_node>& binary, uint32_t index);
+};
+
+template <int N>
+wide_bvh<N>::wide_bvh(const hittable_list& list) {
+	linear_bvh binary(list);
+	if (binary.nodes.empty())
+		return;
+
+	binary.bounding_box(0, 0, box);
+	nodes.reserve(binary.nodes.size() / 2 + 1);
+
+	//leaves keep pointing at the same primitive ranges, so the primitives can just be taken over
+	collapse(binary.nodes, 0);
+	prims = std::move(binary.prims);
+}
+
+template <int N>
+uint32_t wide_bvh<N>::collapse(const buffer<linear_bvh_node>& binary, uint32_t index) {
+	auto out = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	//pull grandchildren up until all lanes are used, always opening the child with the largest area
+	std::vector<uint32_t> lanes;
+	if (binary[index].is_leaf()) {
+		lanes.push_back(index);
+	}
+	else {
+		lanes.push_back(index + 1);
+		lanes.push_back(binary[index].offset);
+	}
+
+	auto area = [&](uint32_t i) {
+		const auto& n = binary[i];
+		auto dx = n.bmax[0] - n.bmin[0], dy = n.bmax[1] - n.bmin[1], dz = n.bmax[2] - n.bmin[2];
+		return dx * dy + dy * dz + dz * dx;
+	};
+
+	while (lanes.size() < N) {
+		int widest = -1;
+		for (int i = 0; i < static_cast<int>(lanes.size()); i++)
+			if (!binary[lanes[i]].is_leaf() && (widest < 0 || area(lanes[i]) > area(lanes[widest])))
+				widest = i;
+		if (widest < 0)
+			break;
+
+		auto opened = lanes[widest];
+		lanes[widest] = opened + 1;
+		lanes.push_back(binary[opened].offset);
+	}
+
+	//children first, they may grow the vector and move this node around
+	uint32_t child[N] = {};
+	for (size_t i = 0; i < lanes.size(); i++)
+		child[i] = binary[lanes[i]].is_leaf() ? binary[lanes[i]].offset : collapse(binary, lanes[i]);
+
+	auto& node = nodes[out];
+	node.children = static_cast<uint8_t>(lanes.size());
+	for (int i = 0; i < N; i++) {
+		//unused lanes get an empty box at the origin, the lane mask throws them out anyway
+		bool used = i < static_cast<int>(lanes.size());
+		for (int a = 0; a < 3; a++) {
+			node.bmin[a][i] = used ? binary[lanes[i]].bmin[a] : 0;
+			node.bmax[a][i] = used ? binary[lanes[i]].bmax[a] : 0;
+		}
+		node.child[i] = used ? child[i] : 0;
+		node.count[i] = used ? binary[lanes[i]].count : 0;
+	}
+	return out;
+}
+
+template <int N>
+bool wide_bvh<N>::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	if (nodes.empty())
+		return false;
+
+	wide_ray wr;
+	for (int a = 0; a < 3; a++) {
+		wr.origin[a] = r.origin()[a];
+		wr.inv_dir[a] = 1 / r.direction()[a];
+	}
+
+	struct entry {
+		uint32_t node;
+		float t;
+	};
+
+	//every level pushes at most N - 1 entries on top of the one it popped
+	entry stack[linear_bvh::max_depth * (N - 1) + 1];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, t_min };
+	bool hit_anything = false;
+
+	while (stack_size > 0) {
+		auto current = stack[--stack_size];
+		if (current.t > t_max)
+			continue; //something closer got hit since this was pushed
+
+		const auto& node = nodes[current.node];
+		alignas(32) float t_near[N];
+		auto mask = hit_wide_node<N>(node, wr, t_min, t_max, t_near);
+
+		//sort the hit children by distance, there are at most N of them
+		int order[N];
+		int hits = 0;
+		for (int i = 0; i < N; i++) {
+			if (!(mask & (1u << i)))
+				continue;
+			int j = hits++;
+			while (j > 0 && t_near[order[j - 1]] > t_near[i]) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+
+		//leaves right away, nearest first...
+		for (int k = 0; k < hits; k++) {
+			int i = order[k];
+			if (node.count[i] == 0 || t_near[i] > t_max)
+				continue;
+			for (uint32_t p = node.child[i]; p < node.child[i] + node.count[i]; p++) {
+				if (prims.hit(prims.refs[p], r, t_min, t_max, rec)) {
+					hit_anything = true;
+					t_max = rec.t;
+				}
+			}
+		}
+
+		//...then the child nodes, pushed farthest first so the nearest gets popped next
+		for (int k = hits - 1; k >= 0; k--) {
+			int i = order[k];
+			if (node.count[i] == 0 && t_near[i] <= t_max)
+				stack[stack_size++] = { node.child[i], t_near[i] };
+		}
+	}
+
+	return hit_anything;
+}
+
+//inner nodes only get one box test for the whole packet, the rays are looked at one by one only in nodes with leaves
+template <int N>
+void wide_bvh<N>::hit_packet(ray_packet& packet, float t_min) const {
+	packet_frustum f;
+	if (nodes.empty() || packet.size == 0 || !f.build(packet)) {
+		hittable::hit_packet(packet, t_min);
+		return;
+	}
+
+	wide_ray wr[ray_packet::max_size];
+	float t_max[ray_packet::max_size];
+	for (int i = 0; i < packet.size; i++) {
+		for (int a = 0; a < 3; a++) {
+			wr[i].origin[a] = packet.rays[i].origin()[a];
+			wr[i].inv_dir[a] = 1 / packet.rays[i].direction()[a];
+		}
+		t_max[i] = infinity;
+	}
+	packet.hits = 0;
+
+	//the farthest any ray still has to look, nodes beyond it can't change anything
+	float packet_t_max = infinity;
+
+	struct entry {
+		uint32_t node;
+		float t;
+	};
+
+	entry stack[linear_bvh::max_depth * (N - 1) + 1];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, t_min };
+
+	while (stack_size > 0) {
+		auto current = stack[--stack_size];
+		if (current.t > packet_t_max)
+			continue;
+
+		const auto& node = nodes[current.node];
+		alignas(32) float t_near[N];
+		auto mask = hit_wide_node<N>(node, f, t_min, packet_t_max, t_near);
+
+		//same order as for a single ray, by where the packet could enter each child
+		int order[N];
+		int hits = 0;
+		uint32_t leaves = 0;
+		for (int i = 0; i < N; i++) {
+			if (!(mask & (1u << i)))
+				continue;
+			if (node.count[i] != 0)
+				leaves |= 1u << i;
+			int j = hits++;
+			while (j > 0 && t_near[order[j - 1]] > t_near[i]) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+
+		if (leaves) {
+			for (int r = 0; r < packet.size; r++) {
+				alignas(32) float ray_t_near[N];
+				auto ray_leaves = hit_wide_node<N>(node, wr[r], t_min, t_max[r], ray_t_near) & leaves;
+				for (int k = 0; k < hits && ray_leaves; k++) {
+					int i = order[k];
+					if (!(ray_leaves & (1u << i)) || ray_t_near[i] > t_max[r])
+						continue;
+					for (uint32_t p = node.child[i]; p < node.child[i] + node.count[i]; p++) {
+						if (prims.hit(prims.refs[p], packet.rays[r], t_min, t_max[r], packet.recs[r])) {
+							packet.hits |= 1u << r;
+							t_max[r] = packet.recs[r].t;
+						}
+					}
+				}
+			}
+
+			packet_t_max = 0;
+			for (int r = 0; r < packet.size; r++)
+				packet_t_max = std::max(packet_t_max, t_max[r]);
+		}
+
+		for (int k = hits - 1; k >= 0; k--) {
+			int i = order[k];
+			if (node.count[i] == 0 && t_near[i] <= packet_t_max)
+				stack[stack_size++] = { node.child[i], t_near[i] };
+		}
+	}
+}
+
+template <int N>
+bool wide_bvh<N>::bounding_box(float time0, float time1, aabb& output_box) const {
+	if (nodes.empty())
+		return false;
+
+	output_box = box;
+	return true;
+}
+
+//the bvh layout to use: 8 wide with avx2, 4 wide with sse, binary otherwise
+inline int bvh_width(int width = RT_BVH_WIDTH) {
+	if (width != 0)
+		return width;
+#ifdef RT_HAS_SSE
+	return cpu_has_avx2() ? 8 : 4;
+#else
+	return 2;
+#endif
+}
+
+std::unique_ptr<hittable> build_bvh(const hittable_list& world, int width = RT_BVH_WIDTH) {
+	switch (bvh_width(width)) {
+	case 8:		return std::make_unique<wide_bvh<8>>(world);
+	case 4:		return std::make_unique<wide_bvh<4>>(world);
+	default:	return std::make_unique<linear_bvh>(world);
+	}
+}
+
+//a bottom level bvh, for geometry that gets placed many times with instance (see instance.h)
+shared_ptr<hittable> make_blas(const hittable_list& objects, int width = RT_BVH_WIDTH) {
+	return build_bvh(objects, width);
+}
+
+//the primitives of a bvh made by build_bvh, nullptr for anything else
+const primitive_store* bvh_primitives(const hittable& bvh) {
+	if (auto w8 = dynamic_cast<const wide_bvh<8>*>(&bvh))
+		return &w8->prims;
+	if (auto w4 = dynamic_cast<const wide_bvh<4>*>(&bvh))
+		return &w4->prims;
+	if (auto binary = dynamic_cast<const linear_bvh*>(&bvh))
+		return &binary->prims;
+	return nullptr;
+}
+
+#endif // !WIDE_BVH_H